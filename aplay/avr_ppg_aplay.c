@@ -1,10 +1,16 @@
 #include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <math.h>
 
 #include "evu10_waveforms.h"
 #include "evu10_wavetable.h"
+#include "../src/synth_core.h"
+#include "../src/lfo.h"
+#include "../src/voice.h"
+#include "../src/pitch.h"
+#include "voice_simd.h"
+#include "ppg_bank.h"
 
 /**
 	\file avr_ppg_aplay.c
@@ -12,210 +18,306 @@
 	
 	\brief A proof-of-concept implementation of wavetable synthesis (based on PPG Wave) meant for AVR devices. 
 	
-	All calculations are performed using variables no bigger than 16 bits. The file could still probably
-	use some optimisations, but I'll leave that for later, when I actually get to work with the real hardware.
+	All calculations are performed using variables no bigger than 16 bits. The DSP kernels (waveform
+	reading, wavetable loading and the filters) are shared with the AVR firmware (see synth_core.h),
+	so whatever is measured here applies to the code running in the ISR as well.
 	
 	For now, this program outputs 8-bit data meant for aplay on stdout. The sampling frequency is configured
-	using SAMPLING_FREQ macro.
+	using SAMPLING_FREQ macro. Samples are rendered in blocks (see render_block()), so the program
+	can run much faster than real time.
+
+	Usage: avr_ppg_aplay [sample count (0 - no limit)] [wavetable number] [notes]
+
+	By default a single oscillator is played. If a comma-separated list of MIDI notes is given,
+	the notes are played by the polyphonic voice engine (see voice.h) instead. The number of
+	voices is set at compile time (VOICES in the makefile). The voices are mixed by the best
+	SIMD kernel this CPU supports, unless VOICE_KERNEL environment variable selects one
+	(scalar, sse2 or avx2). The oscillator and the voices read the slot cache, unless VOICE_SOURCE
+	selects expanded cycles (expanded) or the mirrored half-waves (half-waves - the reference path).
+
+	The waveforms and wavetables are compiled in, unless PPG_BANK environment variable names
+	a bank file (see ppg_bank.h, make bank) - the bank is then mapped and played in place.
 	
+	Key waves of the wavetable are expanded once into full 128-sample cycles (see expand_wavetable()),
+	so reading a sample doesn't involve waveform mirroring. If the data headers or the bank are generated with
+	pre-expanded waveforms (APLAY_DATA_FLAGS=-x), the cycles are used directly. Crossfaded slots are cached as well
+	(see struct slot_cache), so in the steady state a sample is a single lookup.
+
 	I've also implemented two 1-pole filters chained together. They work pretty nicely and surely make the sound
 	more sophisticated.
 	
-	There's still a lot of work to do - for example LFO and EGs.
+	The wavetable slot and the filter coefficient are modulated by fixed-point LFOs (see lfo.h)
+	updated at control rate - the same code is used by the AVR firmware.
+
+	There's still a lot of work to do - for example EGs.
 */
 
 //! I think we can manage that...
 #define SAMPLING_FREQ 20000
 
-//! This would be 64, but we don't need the additional 3 waveforms that PPG provides
-#define DEFAULT_WAVETABLE_SIZE 61
+//! Control rate divider - LFOs are updated once every CONTROL_RATE_DIV samples
+#define CONTROL_RATE_DIV 32
+#define CONTROL_RATE ( SAMPLING_FREQ / CONTROL_RATE_DIV )
+
+//! Number of samples rendered and written at once
+#define RENDER_BLOCK_SIZE 4096
 
 //! Contains currently used wavetable
-static struct wavetable_entry
+static struct wavetable_entry current_wavetable[DEFAULT_WAVETABLE_SIZE];
+
+//! Bank file given with PPG_BANK (if any)
+static struct ppg_bank bank;
+
+//! The same wavetable with all key waves expanded into full cycles - this is what's played
+static struct waveform_cache waveform_cache;
+static struct wavetable_entry expanded_wavetable[DEFAULT_WAVETABLE_SIZE];
+static const uint8_t *expanded_waveforms;
+
+//! Half-waves the wavetable refers to (NULL if the waveforms are pre-expanded)
+static const uint8_t *raw_waveforms;
+
+//! Crossfaded cycles of the used slots of the expanded wavetable
+static struct slot_cache slot_cache;
+
+//! Renderer state - persists between render_block() calls
+static struct render_state
 {
-	uint8_t *ptr_l;
-	uint8_t *ptr_r;
-	uint8_t factor;
-	uint8_t is_key;
-} current_wavetable[DEFAULT_WAVETABLE_SIZE];
-
-//! Returns a pointer to the wave with certain index (that can later be passed to get_waveform_sample())
-static inline uint8_t *get_waveform_pointer( uint8_t index )
+	// DDS
+	uint16_t phase;
+	uint16_t pitch;
+
+	// Control rate counter and modulation sources
+	uint8_t control_cnt;
+	struct lfo slot_lfo;
+	struct lfo filter_lfo;
+
+	// Control values
+	uint16_t slot;
+	int8_t k;
+
+	// Waveform source (the slot cache, unless it's NULL)
+	const struct wavetable_entry *wavetable;
+	const uint8_t *waveforms;
+	uint8_t expanded;
+	struct slot_cache *slot_cache;
+
+	// Filters
+	filter1pole Fa, Fb;
+
+	// Polyphonic mode
+	uint8_t poly;
+	struct voice_bank voices;
+} render_state =
 {
-	return evu10_waveforms + ( index << 6 );
-}
+	.pitch = PITCH( 35 ),
+	.slot_lfo = {.step = LFO_STEP( 159, CONTROL_RATE ), .shape = LFO_SINE},
+	.filter_lfo = {.step = LFO_STEP( 5093, CONTROL_RATE ), .shape = LFO_SINE},
+};
 
-//! This shall act as pgm_read_byte()
-static inline uint8_t get_waveform_sample( uint8_t *ptr, uint8_t sample )
+//! Updates control values (called once every CONTROL_RATE_DIV samples)
+static void render_control_update( struct render_state *s )
 {
-	return ptr[sample];
+	s->slot = SLOT_POSITION( 30 ) + lfo_update( &s->slot_lfo ) * 60;
+	s->k = 64 + lfo_scale( lfo_update( &s->filter_lfo ), 60 );
+
+	if ( s->poly )
+	{
+		for ( voice_id v = 0; v < VOICE_COUNT; v++ )
+			s->voices.slot[v] = s->slot;
+		s->voices.k = s->k;
+		voice_control( &s->voices );
+	}
 }
 
-//! Reads sample from a 64-byte waveform buffer based on 16-bit phase value
-static inline uint8_t get_waveform_sample_by_phase( uint8_t *ptr, uint16_t phase2b )
+//! Renders n samples of the single oscillator
+static void render_mono( struct render_state *s, uint8_t *out, size_t n )
 {
-	// This phase ranges 0-127
-	uint8_t phase = ((uint8_t*) &phase2b)[1] >> 1;
-	uint8_t half_select = phase & 64;
-	phase &= 63; // Poor man's modulo 64
-
-	// Waveform mirroring
-	if ( half_select )
-		return get_waveform_sample( ptr, phase );
+	uint16_t phase_step = pitch_step( s->pitch, PITCH_BASE( SAMPLING_FREQ ) );
+	const uint8_t *cycle = NULL;
+	struct wavetable_entry e;
+	if ( s->slot_cache != NULL )
+		cycle = slot_cache_get( s->slot_cache, s->slot );
 	else
-		return 255u - get_waveform_sample( ptr, 63u - phase );
-}
+		get_slot_entry( &e, s->wavetable, s->slot );
 
-//! Reads a single sample based on a wavetable entry
-static inline uint8_t get_wavetable_sample( const struct wavetable_entry *e, uint16_t phase2b )
-{
-	uint8_t sample_l = get_waveform_sample_by_phase( e->ptr_l, phase2b );
-	uint8_t sample_r = get_waveform_sample_by_phase( e->ptr_r, phase2b );
-	uint8_t factor = e->factor;
-	uint16_t mix_l = ( 256 - factor ) * sample_l;
-	uint16_t mix_r = factor * sample_r;
-	uint16_t mix = mix_l + mix_r;
-	return mix >> 8;
-}
+	for ( size_t i = 0; i < n; i++ )
+	{
+		// Waveform generation
+		uint8_t sample;
+		if ( cycle != NULL )
+			sample = get_cycle_sample_by_phase( cycle, s->phase );
+		else if ( s->expanded )
+			sample = get_expanded_wavetable_sample( s->waveforms, &e, s->phase );
+		else
+			sample = get_wavetable_sample( s->waveforms, &e, s->phase );
 
-//! Reads a single sample from the global wavetable
-static inline uint8_t get_current_wavetable_sample( uint8_t slot, uint16_t phase2b )
-{
-	return get_wavetable_sample( current_wavetable + slot, phase2b );
+		// Two 1-pole filters chained together
+		audio_signal x = sample - 127;
+		audio_signal y = filter1pole_feed( &s->Fb, s->k, filter1pole_feed( &s->Fa, s->k, x ) );
+
+		// Audio output and phase stepping
+		out[i] = 127 + y;
+		s->phase += phase_step;
+	}
 }
 
-/**
-	Load a wavetable stored in PPG Wave 2.2 format into an array of wavetable_entry structs of size wavetable_size
-	Returns a pointer to the next wavetable
-*/
-const uint8_t *load_wavetable( struct wavetable_entry *entries, uint8_t wavetable_size, const uint8_t *data )
+//! Renders n samples into the out buffer
+void render_block( uint8_t *out, size_t n )
 {
-	// Wipe the wavetable
-	memset( entries, 0, wavetable_size * sizeof( struct wavetable_entry ) );
+	struct render_state *s = &render_state;
 
-	// The fist byte is ignored
-	data++;
-
-	// Read wavetable entries up to wavetable slot 60
-	uint8_t waveform, pos;
-	do
+	while ( n )
 	{
-		waveform = *data++;
-		pos = *data++;
-		
-		entries[pos].ptr_l = get_waveform_pointer( waveform );
-		entries[pos].ptr_r = NULL;
-		entries[pos].factor = 0;
-		entries[pos].is_key = 1;
-	}
-	while ( pos < wavetable_size - 1 );
-
-	// Now, generate interpolation coefficients
-	struct wavetable_entry *el = NULL, *er = NULL;
-	for ( uint8_t i = 0; i < wavetable_size; i++ )
-	{
-		// If the current entry contains a key-wave
-		if ( entries[i].is_key )
+		// Control rate update
+		if ( s->control_cnt == 0 )
 		{
-			el = &entries[i];
-			
-			// Look for the next key-wave
-			for ( uint8_t j = i + 1; j < wavetable_size; j++ )
-			{
-				if ( entries[j].is_key )
-				{
-					er = &entries[j];
-					break;
-				}
-			}
+			s->control_cnt = CONTROL_RATE_DIV;
+			render_control_update( s );
 		}
 
-		// Total distance between known key-waves and distance from the left one 
-		uint8_t distance_total = er - el;
-		uint8_t distance_l = &entries[i] - el;
-
-		entries[i].ptr_l = el->ptr_l;
-		entries[i].ptr_r = er->ptr_l;
-
-		// We have to avoid division by 0 for the last slot
-		if ( distance_total != 0 )
-			entries[i].factor = ( 65535 / distance_total * distance_l ) >> 8;
+		// Render up to the next control rate update
+		size_t len = n < s->control_cnt ? n : s->control_cnt;
+		if ( s->poly )
+			voice_render( &s->voices, s->wavetable, out, len );
 		else
-			entries[i].factor = 0;
-	}
+			render_mono( s, out, len );
 
-	// Return pointer to the next wavetable
-	return data;
+		s->control_cnt -= len;
+		out += len;
+		n -= len;
+	}
 }
 
-//! Loads n-th requested wavetable from binary format
-//! \see load_wavetable()
-const uint8_t *load_wavetable_n( struct wavetable_entry *entries, uint8_t wavetable_size, const uint8_t *data, uint8_t index )
+//! Selects the waveform source given with VOICE_SOURCE (the slot cache by default)
+static int render_set_source( struct render_state *s )
 {
-	for ( uint8_t i = 0; i < index + 1; i++ )
-		data = load_wavetable( entries, wavetable_size, data );
-	return data;
-}
+	s->wavetable = expanded_wavetable;
+	s->waveforms = expanded_waveforms;
+	s->expanded = 1;
+	s->slot_cache = &slot_cache;
+
+	const char *source = getenv( "VOICE_SOURCE" );
+	if ( source != NULL && !strcmp( source, "expanded" ) )
+		s->slot_cache = NULL;
+	else if ( source != NULL && !strcmp( source, "half-waves" ) && raw_waveforms != NULL )
+	{
+		s->wavetable = current_wavetable;
+		s->waveforms = raw_waveforms;
+		s->expanded = 0;
+		s->slot_cache = NULL;
+	}
+	else if ( source != NULL && strcmp( source, "slot-cache" ) )
+	{
+		fprintf( stderr, "waveform source '%s' is not available\n", source );
+		return 1;
+	}
 
-//! Safe add (no overflow and underflow)
-static inline int16_t safe_add( int16_t a, int16_t b )
-{
-	if ( a > 0 && b > INT16_MAX - a )
-		return INT16_MAX;
-	else if ( a < 0 && b < INT16_MIN - a )
-		return INT16_MIN;
-	return a + b;
+	return 0;
 }
 
-// A 16-bit overflow/underflow-safe digital integrator
-typedef int16_t integrator;
-static inline integrator integrator_feed( integrator *i, integrator x )
+//! Starts playing comma-separated list of MIDI notes using the voice engine
+static int render_play_notes( struct render_state *s, const char *notes )
 {
-	return *i = safe_add( *i, x );
-	// return *i += x;
-}
+	s->poly = 1;
+	voice_bank_init( &s->voices );
+	s->voices.waveforms = s->waveforms;
+	s->voices.expanded = s->expanded;
+	s->voices.slot_cache = s->slot_cache;
+
+	// Voice mixing kernel
+	const char *kernel = getenv( "VOICE_KERNEL" );
+	s->voices.render_mix = voice_simd_kernel( kernel );
+	if ( s->voices.render_mix == NULL )
+	{
+		fprintf( stderr, "voice kernel '%s' is not available\n", kernel );
+		return 1;
+	}
 
-//! A 1 pole filter based on the above integrator
-//! \see integrator
-typedef int8_t audio_signal;
-typedef integrator filter1pole;
-static inline audio_signal filter1pole_feed( filter1pole *f, int8_t k, audio_signal x )
-{
-	integrator_feed( f, ( x - ( *f / 256 ) ) * k );
-	return *f / 256;
+	for ( char *end; *notes; notes = *end ? end + 1 : end )
+	{
+		unsigned int note = strtoul( notes, &end, 0 ) & 127;
+		voice_note_on( &s->voices, note, 100, voice_pitch_step( PITCH( note ), PITCH_BASE( SAMPLING_FREQ ) ), s->slot );
+		if ( end == notes ) break;
+	}
+
+	return 0;
 }
 
 int main( int argc, char **argv )
 {
-	// Load wavetable
-	load_wavetable_n( current_wavetable, DEFAULT_WAVETABLE_SIZE, evu10_wavetable, 18 );
+	// Number of samples to render (0 - no limit) and wavetable number
+	unsigned long long sample_limit = argc > 1 ? strtoull( argv[1], NULL, 0 ) : 0;
+	unsigned int wavetable = argc > 2 ? strtoul( argv[2], NULL, 0 ) : 18;
+
+	// Locate the wavetable - in the bank file or in the compiled-in data
+	const char *bank_path = getenv( "PPG_BANK" );
+	const uint8_t *waveforms, *data;
+	unsigned int waveform_size;
+	if ( bank_path != NULL )
+	{
+		if ( !ppg_bank_open( &bank, bank_path ) )
+			return 1;
 
-	// The main loop
-	while ( 1 )
+		data = ppg_bank_wavetable( &bank, wavetable );
+		if ( data == NULL )
+		{
+			fprintf( stderr, "invalid wavetable number - there are %u wavetables in %s\n", bank.header->wavetable_count, bank_path );
+			return 1;
+		}
+		waveforms = bank.waveforms;
+		waveform_size = bank.header->waveform_size;
+	}
+	else
+	{
+		static struct wavetable_index index;
+		wavetable_index_scan( &index, DEFAULT_WAVETABLE_SIZE, evu10_wavetable, sizeof( evu10_wavetable ) );
+		if ( wavetable >= index.count )
+		{
+			fprintf( stderr, "invalid wavetable number - there are %d wavetables\n", index.count );
+			return 1;
+		}
+		data = wavetable_index_get( &index, wavetable );
+		waveforms = evu10_waveforms;
+		waveform_size = EVU10_WAVEFORM_SIZE;
+	}
+
+	// Load it and get the key waves as full cycles (pre-expanded ones are used in place)
+	load_wavetable( current_wavetable, DEFAULT_WAVETABLE_SIZE, data );
+	if ( waveform_size == WAVEFORM_CYCLE_SIZE )
+	{
+		memcpy( expanded_wavetable, current_wavetable, sizeof( expanded_wavetable ) );
+		expanded_waveforms = waveforms;
+	}
+	else if ( expand_wavetable( expanded_wavetable, current_wavetable, DEFAULT_WAVETABLE_SIZE, waveforms, &waveform_cache ) )
+	{
+		expanded_waveforms = waveform_cache.cycle[0];
+		raw_waveforms = waveforms;
+	}
+	else
 	{
-		// DDS
-		static uint16_t phase = 0;
-		static float f = 62;
-		uint16_t phase_step = 65536 * f / SAMPLING_FREQ;
+		fprintf( stderr, "waveform cache is too small\n" );
+		return 1;
+	}
+	slot_cache_init( &slot_cache, expanded_wavetable, expanded_waveforms, 1 );
+	if ( render_set_source( &render_state ) )
+		return 1;
 
-		// Time counter
-		static uint32_t cnt = 0;
-		static float t = 0;
-		cnt++;
-		t = (float)cnt / SAMPLING_FREQ;
+	// Polyphonic mode
+	if ( argc > 3 && render_play_notes( &render_state, argv[3] ) )
+		return 1;
 
-		// Waveform generation
-		uint8_t sample = get_current_wavetable_sample( 30 + 30 * sin( t ), phase  );
-		
-		// Two 1-pole filters chained together
-		audio_signal x = sample - 127;
-		int8_t k = 64 + sin( 32 * t ) * 30;
-		static filter1pole Fa = 0, Fb = 0;
-		audio_signal y = filter1pole_feed( &Fb, k, filter1pole_feed( &Fa, k, x ) );
-		
-		// Audio output and phase stepping
-		putchar( 127 + y );
-		phase += phase_step;
+	// The main loop
+	static uint8_t buffer[RENDER_BLOCK_SIZE];
+	for ( unsigned long long rendered = 0; !sample_limit || rendered < sample_limit; )
+	{
+		size_t n = RENDER_BLOCK_SIZE;
+		if ( sample_limit && sample_limit - rendered < n )
+			n = sample_limit - rendered;
+
+		render_block( buffer, n );
+		if ( fwrite( buffer, 1, n, stdout ) != n )
+			return 1;
+		rendered += n;
 	}
 
 	return 0;
@@ -3,6 +3,9 @@
 
 #include <inttypes.h>
 
+//! Size of a waveform - 64 for half-waves or 128 for pre-expanded cycles
+#define EVU10_WAVEFORM_SIZE 64
+
 static uint8_t evu10_waveforms[] = {
 	131,	// -------- wave 000 (00h), sample 00
 	162,	// sample 01
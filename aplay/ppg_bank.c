@@ -0,0 +1,125 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ppg_bank.h"
+#include "../src/synth_core.h"
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "bank files are used in place, so a little-endian host is required"
+#endif
+
+//! Checks if a region lies within the file
+static int ppg_bank_contains( const struct ppg_bank *bank, uint64_t offset, uint64_t size )
+{
+	return offset <= bank->size && size <= bank->size - offset;
+}
+
+/**
+	Maps a bank file - only the header is checked, so this takes constant time
+	\returns 0 on error (reported on stderr)
+*/
+uint8_t ppg_bank_open( struct ppg_bank *bank, const char *path )
+{
+	memset( bank, 0, sizeof( *bank ) );
+
+	int fd = open( path, O_RDONLY );
+	if ( fd < 0 )
+	{
+		perror( path );
+		return 0;
+	}
+
+	struct stat st;
+	if ( fstat( fd, &st ) || st.st_size < (off_t) sizeof( struct ppg_bank_header ) )
+	{
+		fprintf( stderr, "ppg_bank: %s is not a bank file\n", path );
+		close( fd );
+		return 0;
+	}
+
+	void *map = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+	if ( map == MAP_FAILED )
+	{
+		perror( path );
+		return 0;
+	}
+
+	bank->map = map;
+	bank->size = st.st_size;
+	bank->header = map;
+
+	const struct ppg_bank_header *h = bank->header;
+	const char *error = NULL;
+	if ( memcmp( h->magic, PPG_BANK_MAGIC, sizeof( h->magic ) ) )
+		error = "is not a bank file";
+	else if ( h->version != PPG_BANK_VERSION || h->header_size != sizeof( struct ppg_bank_header ) )
+		error = "has unsupported version";
+	else if ( ( h->waveform_size != 64 && h->waveform_size != WAVEFORM_CYCLE_SIZE ) || h->waveform_count > 256 )
+		error = "has invalid waveforms";
+	else if ( h->wavetable_size != DEFAULT_WAVETABLE_SIZE )
+		error = "has unsupported wavetable size";
+	else if ( !ppg_bank_contains( bank, h->waveforms_offset, (uint64_t) h->waveform_count * h->waveform_size )
+		|| h->waveforms_offset % PPG_BANK_WAVEFORM_ALIGN
+		|| !ppg_bank_contains( bank, h->wavetable_index_offset, ( (uint64_t) h->wavetable_count + 1 ) * sizeof( uint32_t ) )
+		|| h->wavetable_index_offset % sizeof( uint32_t )
+		|| !ppg_bank_contains( bank, h->metadata_offset, h->metadata_size ) )
+		error = "is truncated";
+
+	if ( error == NULL )
+	{
+		bank->waveforms = bank->map + h->waveforms_offset;
+		bank->wavetable_index = (const uint32_t *)( bank->map + h->wavetable_index_offset );
+		bank->wavetable_data = bank->map + h->wavetable_data_offset;
+		bank->metadata = (const char *)( bank->map + h->metadata_offset );
+
+		// The last index entry is the size of the wavetable data
+		if ( !ppg_bank_contains( bank, h->wavetable_data_offset, bank->wavetable_index[h->wavetable_count] ) )
+			error = "is truncated";
+	}
+
+	if ( error != NULL )
+	{
+		fprintf( stderr, "ppg_bank: %s %s\n", path, error );
+		ppg_bank_close( bank );
+		return 0;
+	}
+
+	return 1;
+}
+
+//! Unmaps a bank file
+void ppg_bank_close( struct ppg_bank *bank )
+{
+	if ( bank->map != NULL ) munmap( (void *) bank->map, bank->size );
+	memset( bank, 0, sizeof( *bank ) );
+}
+
+/**
+	Returns a pointer to the n-th wavetable in the bank (for load_wavetable()).
+	The wavetable is validated first - it has to fit in its index entry and can only
+	refer to waveforms present in the bank.
+	\returns NULL if there's no such wavetable or it's invalid
+*/
+const uint8_t *ppg_bank_wavetable( const struct ppg_bank *bank, uint32_t n )
+{
+	const struct ppg_bank_header *h = bank->header;
+	if ( n >= h->wavetable_count ) return NULL;
+
+	uint32_t begin = bank->wavetable_index[n], end = bank->wavetable_index[n + 1];
+	if ( begin >= end || end > bank->wavetable_index[h->wavetable_count] ) return NULL;
+
+	const uint8_t *data = bank->wavetable_data + begin;
+	const uint8_t *next = skip_wavetable( h->wavetable_size, data, bank->wavetable_data + end );
+	if ( next == NULL ) return NULL;
+
+	for ( const uint8_t *ptr = data + 1; ptr < next; ptr += 2 )
+		if ( *ptr >= h->waveform_count ) return NULL;
+
+	return data;
+}
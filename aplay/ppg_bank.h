@@ -0,0 +1,71 @@
+#ifndef PPG_BANK_H
+#define PPG_BANK_H
+#include <inttypes.h>
+#include <stddef.h>
+
+/**
+	\file ppg_bank.h
+	\brief Wavetable bank files
+
+	A bank holds waveforms and wavetables in a single binary file, so aplay can play data
+	without being rebuilt (see tools/ppgdata, -f bank). The file is mapped read-only and
+	used in place - nothing is parsed or copied on open, so opening a bank takes the same
+	time no matter how many wavetables it holds. A wavetable is only validated when it's
+	requested with ppg_bank_wavetable().
+
+	All fields are little-endian. The file starts with struct ppg_bank_header, the rest
+	is located by its offsets (from the beginning of the file):
+	 - metadata       - metadata_size bytes of text, one "key=value" per line
+	 - wavetable index - wavetable_count + 1 32-bit offsets into the wavetable data
+	                     (4-byte aligned) - the last one is the size of the wavetable data
+	 - wavetable data - wavetables in the PPG format (see load_wavetable())
+	 - waveforms      - waveform_count waveforms, waveform_size bytes each (64 for half-waves
+	                    or 128 for pre-expanded cycles), aligned to 64 bytes
+
+	Wavetables refer to waveforms by 8-bit numbers, so a bank has up to 256 waveforms.
+*/
+
+#define PPG_BANK_MAGIC "PPGBANK"
+#define PPG_BANK_VERSION 1
+
+//! Alignment of the waveforms in the file
+#define PPG_BANK_WAVEFORM_ALIGN 64
+
+//! Bank file header
+struct ppg_bank_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+
+	uint32_t waveform_size;
+	uint32_t waveform_count;
+	uint32_t waveforms_offset;
+
+	uint32_t wavetable_size;
+	uint32_t wavetable_count;
+	uint32_t wavetable_index_offset;
+	uint32_t wavetable_data_offset;
+
+	uint32_t metadata_offset;
+	uint32_t metadata_size;
+};
+
+//! A mapped bank file
+struct ppg_bank
+{
+	const uint8_t *map;
+	size_t size;
+
+	const struct ppg_bank_header *header;
+	const uint8_t *waveforms;
+	const uint32_t *wavetable_index;
+	const uint8_t *wavetable_data;
+	const char *metadata;
+};
+
+extern uint8_t ppg_bank_open( struct ppg_bank *bank, const char *path );
+extern void ppg_bank_close( struct ppg_bank *bank );
+extern const uint8_t *ppg_bank_wavetable( const struct ppg_bank *bank, uint32_t n );
+
+#endif
@@ -0,0 +1,426 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "evu10_waveforms.h"
+#include "evu10_wavetable.h"
+#include "../src/synth_core.h"
+#include "../src/voice.h"
+#include "../src/pitch.h"
+#include "voice_simd.h"
+
+/**
+	\file ppg_bench.c
+	\brief Microbenchmarks of the DSP kernels
+
+	Times the kernels shared with the firmware (see synth_core.h) in isolation and the
+	complete voice loop with every mixing kernel and waveform source, over all wavetables
+	in evu10_wavetable. Every benchmark is run BENCH_RUNS times and the fastest run is
+	reported, which filters out most of the noise. A run takes at least BENCH_RUN_TIME.
+
+	The results are printed as JSON on stdout - one result per line:
+	{"name": ..., "op": ..., "ops": ..., "ns_per_op": ..., "ops_per_sec": ...}
+	An op is a sample, except for load_wavetable, where it's a whole wavetable.
+
+	With -c the results are compared with a baseline (the output of an earlier run, see
+	make bench-baseline) on stderr. The exit status is 1 if any benchmark got slower by
+	more than the threshold (-t, 10% by default).
+
+	Usage: ppg_bench [-c baseline] [-t threshold %]
+*/
+
+//! Number of runs of each benchmark - the fastest one counts
+#define BENCH_RUNS 5
+
+//! Minimum duration of a run in seconds
+#define BENCH_RUN_TIME 0.1
+
+//! Samples read from each waveform or wavetable slot
+#define BENCH_SLOT_SAMPLES 512
+
+//! Samples rendered by the voice loop per wavetable
+#define BENCH_VOICE_SAMPLES 8192
+
+//! Length of the signal fed to the filters
+#define BENCH_SIGNAL_SIZE 4096
+
+//! Sample rate assumed for the voice pitches
+#define BENCH_SAMPLERATE 20000
+
+//! Benchmark result
+struct bench_result
+{
+	char name[64];
+	const char *op;
+	uint64_t ops;
+	double ns_per_op;
+};
+
+//! All wavetables - loaded and with expanded key waves
+static struct wavetable_index wavetable_index;
+static struct wavetable_entry wavetables[WAVETABLE_INDEX_SIZE][DEFAULT_WAVETABLE_SIZE];
+static struct wavetable_entry expanded_wavetables[WAVETABLE_INDEX_SIZE][DEFAULT_WAVETABLE_SIZE];
+static struct waveform_cache waveform_caches[WAVETABLE_INDEX_SIZE];
+
+//! Test signal for the filters
+static int16_t signal_a[BENCH_SIGNAL_SIZE], signal_b[BENCH_SIGNAL_SIZE];
+
+//! Results are accumulated here, so that nothing is optimized away
+static volatile uint32_t bench_sink;
+
+static struct bench_result results[64];
+static unsigned int result_count;
+
+//! Returns monotonic time in seconds
+static double bench_time( )
+{
+	struct timespec t;
+	clock_gettime( CLOCK_MONOTONIC, &t );
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/**
+	Runs a benchmark and records the fastest of BENCH_RUNS runs. The function returns the number
+	of ops it has done and is called repeatedly until a run takes at least BENCH_RUN_TIME.
+	A warm-up run comes first.
+*/
+static void bench_run( const char *name, const char *op, uint64_t ( *fn )( const void *arg ), const void *arg )
+{
+	struct bench_result *r = &results[result_count++];
+	snprintf( r->name, sizeof( r->name ), "%s", name );
+	r->op = op;
+	r->ns_per_op = 0;
+
+	for ( int i = -1; i < BENCH_RUNS; i++ )
+	{
+		uint64_t ops = 0;
+		double t_start = bench_time( ), t;
+		do
+		{
+			ops += fn( arg );
+			t = bench_time( ) - t_start;
+		}
+		while ( t < BENCH_RUN_TIME );
+
+		double ns = t * 1e9 / ops;
+		if ( i == 0 || ( i > 0 && ns < r->ns_per_op ) )
+		{
+			r->ns_per_op = ns;
+			r->ops = ops;
+		}
+	}
+}
+
+// ---------------------------------------------
+
+//! Half-wave reading with mirroring - the key waves of all slots
+static uint64_t bench_waveform_sample( const void *arg )
+{
+	(void) arg;
+	uint32_t sum = 0;
+	for ( uint8_t w = 0; w < wavetable_index.count; w++ )
+		for ( uint8_t s = 0; s < DEFAULT_WAVETABLE_SIZE; s++ )
+		{
+			const uint8_t *ptr = get_waveform_pointer( evu10_waveforms, wavetables[w][s].wave_l );
+			uint16_t phase = 0;
+			for ( int i = 0; i < BENCH_SLOT_SAMPLES; i++, phase += 0x0123 )
+				sum += get_waveform_sample_by_phase( ptr, phase );
+		}
+
+	bench_sink += sum;
+	return (uint64_t) wavetable_index.count * DEFAULT_WAVETABLE_SIZE * BENCH_SLOT_SAMPLES;
+}
+
+//! Crossfaded slot reading from half-waves
+static uint64_t bench_wavetable_sample( const void *arg )
+{
+	(void) arg;
+	uint32_t sum = 0;
+	for ( uint8_t w = 0; w < wavetable_index.count; w++ )
+		for ( uint8_t s = 0; s < DEFAULT_WAVETABLE_SIZE; s++ )
+		{
+			uint16_t phase = 0;
+			for ( int i = 0; i < BENCH_SLOT_SAMPLES; i++, phase += 0x0123 )
+				sum += get_wavetable_sample( evu10_waveforms, &wavetables[w][s], phase );
+		}
+
+	bench_sink += sum;
+	return (uint64_t) wavetable_index.count * DEFAULT_WAVETABLE_SIZE * BENCH_SLOT_SAMPLES;
+}
+
+//! Crossfaded slot reading from expanded cycles
+static uint64_t bench_expanded_wavetable_sample( const void *arg )
+{
+	(void) arg;
+	uint32_t sum = 0;
+	for ( uint8_t w = 0; w < wavetable_index.count; w++ )
+		for ( uint8_t s = 0; s < DEFAULT_WAVETABLE_SIZE; s++ )
+		{
+			uint16_t phase = 0;
+			for ( int i = 0; i < BENCH_SLOT_SAMPLES; i++, phase += 0x0123 )
+				sum += get_expanded_wavetable_sample( waveform_caches[w].cycle[0], &expanded_wavetables[w][s], phase );
+		}
+
+	bench_sink += sum;
+	return (uint64_t) wavetable_index.count * DEFAULT_WAVETABLE_SIZE * BENCH_SLOT_SAMPLES;
+}
+
+//! Wavetable loading (one op is a whole wavetable)
+static uint64_t bench_load_wavetable( const void *arg )
+{
+	(void) arg;
+	static struct wavetable_entry entries[DEFAULT_WAVETABLE_SIZE];
+	const int repeat = 16;
+	uint32_t sum = 0;
+
+	for ( int r = 0; r < repeat; r++ )
+		for ( uint8_t w = 0; w < wavetable_index.count; w++ )
+		{
+			load_wavetable( entries, DEFAULT_WAVETABLE_SIZE, wavetable_index_get( &wavetable_index, w ) );
+			sum += entries[r % DEFAULT_WAVETABLE_SIZE].factor;
+		}
+
+	bench_sink += sum;
+	return (uint64_t) repeat * wavetable_index.count;
+}
+
+//! Saturating add of independent pairs
+static uint64_t bench_safe_add( const void *arg )
+{
+	(void) arg;
+	const int repeat = 16;
+	uint32_t sum = 0;
+
+	for ( int r = 0; r < repeat; r++ )
+		for ( int i = 0; i < BENCH_SIGNAL_SIZE; i++ )
+			sum += safe_add( signal_a[i], signal_b[i] );
+
+	bench_sink += sum;
+	return (uint64_t) repeat * BENCH_SIGNAL_SIZE;
+}
+
+//! Integrator - a dependency chain of saturating adds
+static uint64_t bench_integrator_feed( const void *arg )
+{
+	(void) arg;
+	const int repeat = 16;
+	integrator acc = 0;
+
+	for ( int r = 0; r < repeat; r++ )
+		for ( int i = 0; i < BENCH_SIGNAL_SIZE; i++ )
+			integrator_feed( &acc, signal_a[i] );
+
+	bench_sink += acc;
+	return (uint64_t) repeat * BENCH_SIGNAL_SIZE;
+}
+
+//! Two chained 1-pole filters (as used by the voices) with a swept coefficient
+static uint64_t bench_filter1pole_feed( const void *arg )
+{
+	(void) arg;
+	const int repeat = 16;
+	filter1pole fa = 0, fb = 0;
+	uint32_t sum = 0;
+
+	for ( int r = 0; r < repeat; r++ )
+	{
+		int8_t k = 4 + r * 7;
+		for ( int i = 0; i < BENCH_SIGNAL_SIZE; i++ )
+			sum += filter1pole_feed( &fb, k, filter1pole_feed( &fa, k, signal_a[i] >> 8 ) );
+	}
+
+	bench_sink += sum;
+	return (uint64_t) repeat * BENCH_SIGNAL_SIZE;
+}
+
+// ---------------------------------------------
+
+//! Voice loop configuration
+struct bench_voice_config
+{
+	voice_kernel kernel;
+	enum
+	{
+		BENCH_HALF_WAVES,
+		BENCH_EXPANDED,
+		BENCH_SLOT_CACHE,
+	} source;
+};
+
+//! The complete voice loop - all voices playing, slot swept at control rate
+static uint64_t bench_voice_render( const void *arg )
+{
+	const struct bench_voice_config *c = arg;
+	static struct voice_bank bank;
+	static struct slot_cache slot_cache;
+	static uint8_t out[BENCH_VOICE_SAMPLES];
+	const int control_block = 32;
+	uint32_t sum = 0;
+
+	for ( uint8_t w = 0; w < wavetable_index.count; w++ )
+	{
+		const struct wavetable_entry *wavetable = wavetables[w];
+
+		voice_bank_init( &bank );
+		bank.render_mix = c->kernel;
+		bank.waveforms = evu10_waveforms;
+		if ( c->source != BENCH_HALF_WAVES )
+		{
+			wavetable = expanded_wavetables[w];
+			bank.waveforms = waveform_caches[w].cycle[0];
+			bank.expanded = 1;
+		}
+		if ( c->source == BENCH_SLOT_CACHE )
+		{
+			slot_cache_init( &slot_cache, wavetable, bank.waveforms, 1 );
+			bank.slot_cache = &slot_cache;
+		}
+
+		for ( voice_id v = 0; v < VOICE_COUNT; v++ )
+			voice_note_on( &bank, 36 + v * 5 % 48, 100, voice_pitch_step( PITCH( 36 + v * 5 % 48 ), PITCH_BASE( BENCH_SAMPLERATE ) ), 0 );
+
+		for ( int i = 0; i < BENCH_VOICE_SAMPLES; i += control_block )
+		{
+			// Triangle sweep through the slots (up and down once per wavetable)
+			uint16_t slot = ( i / control_block * 118 ) % SLOT_POSITION( 2 * 59 );
+			if ( slot > SLOT_POSITION( 59 ) ) slot = SLOT_POSITION( 2 * 59 ) - slot;
+			for ( voice_id v = 0; v < VOICE_COUNT; v++ )
+				bank.slot[v] = slot;
+
+			voice_control( &bank );
+			voice_render( &bank, wavetable, out + i, control_block );
+		}
+
+		sum += out[BENCH_VOICE_SAMPLES - 1];
+	}
+
+	bench_sink += sum;
+	return (uint64_t) wavetable_index.count * BENCH_VOICE_SAMPLES;
+}
+
+// ---------------------------------------------
+
+/**
+	Compares the results with a baseline file
+	\returns the number of benchmarks slower than the threshold
+*/
+static int bench_compare( const char *path, double threshold )
+{
+	FILE *f = fopen( path, "r" );
+	if ( f == NULL )
+	{
+		fprintf( stderr, "ppg_bench: no baseline in %s (make bench-baseline)\n", path );
+		return 0;
+	}
+
+	int regressions = 0;
+	char line[512];
+	fprintf( stderr, "%-40s %12s %12s %8s\n", "benchmark", "baseline ns", "ns", "change" );
+	while ( fgets( line, sizeof( line ), f ) )
+	{
+		char name[64];
+		double ns;
+		const char *p = strstr( line, "\"ns_per_op\": " );
+		if ( sscanf( line, " {\"name\": \"%63[^\"]\"", name ) != 1 || p == NULL || sscanf( p + 13, "%lf", &ns ) != 1 )
+			continue;
+
+		for ( unsigned int i = 0; i < result_count; i++ )
+			if ( !strcmp( results[i].name, name ) )
+			{
+				double change = ( results[i].ns_per_op / ns - 1 ) * 100;
+				int slower = change > threshold;
+				fprintf( stderr, "%-40s %12.3f %12.3f %+7.1f%%%s\n", name, ns, results[i].ns_per_op, change, slower ? " slower" : "" );
+				regressions += slower;
+			}
+	}
+
+	fclose( f );
+	return regressions;
+}
+
+int main( int argc, char **argv )
+{
+	const char *baseline = NULL;
+	double threshold = 10;
+	int opt;
+
+	while ( ( opt = getopt( argc, argv, "c:t:" ) ) != -1 )
+	{
+		switch ( opt )
+		{
+			case 'c': baseline = optarg; break;
+			case 't': threshold = atof( optarg ); break;
+
+			default:
+				fprintf( stderr, "usage: %s [-c baseline] [-t threshold %%]\n", argv[0] );
+				return 1;
+		}
+	}
+
+	// Load and expand all wavetables
+	wavetable_index_scan( &wavetable_index, DEFAULT_WAVETABLE_SIZE, evu10_wavetable, sizeof( evu10_wavetable ) );
+	for ( uint8_t w = 0; w < wavetable_index.count; w++ )
+	{
+		load_wavetable( wavetables[w], DEFAULT_WAVETABLE_SIZE, wavetable_index_get( &wavetable_index, w ) );
+		if ( EVU10_WAVEFORM_SIZE != 64
+			|| !expand_wavetable( expanded_wavetables[w], wavetables[w], DEFAULT_WAVETABLE_SIZE, evu10_waveforms, &waveform_caches[w] ) )
+		{
+			fprintf( stderr, "ppg_bench: the raw waveforms are required (headers generated without -x) and the waveform cache has to fit a wavetable\n" );
+			return 1;
+		}
+	}
+
+	// Deterministic noise for the filters
+	uint32_t seed = 1;
+	for ( int i = 0; i < BENCH_SIGNAL_SIZE; i++ )
+	{
+		seed = seed * 1103515245 + 12345;
+		signal_a[i] = seed >> 16;
+		seed = seed * 1103515245 + 12345;
+		signal_b[i] = seed >> 16;
+	}
+
+	bench_run( "get_waveform_sample_by_phase", "sample", bench_waveform_sample, NULL );
+	bench_run( "get_wavetable_sample", "sample", bench_wavetable_sample, NULL );
+	bench_run( "get_expanded_wavetable_sample", "sample", bench_expanded_wavetable_sample, NULL );
+	bench_run( "load_wavetable", "wavetable", bench_load_wavetable, NULL );
+	bench_run( "safe_add", "sample", bench_safe_add, NULL );
+	bench_run( "integrator_feed", "sample", bench_integrator_feed, NULL );
+	bench_run( "filter1pole_feed x2", "sample", bench_filter1pole_feed, NULL );
+
+	// The voice loop with every available kernel
+	static const char *kernels[] = {"scalar", "sse2", "avx2"};
+	static const char *sources[] = {"half-waves", "expanded", "slot cache"};
+	static struct bench_voice_config configs[3][3];
+	for ( int k = 0; k < 3; k++ )
+	{
+		voice_kernel kernel = voice_simd_kernel( kernels[k] );
+		if ( kernel == NULL ) continue;
+
+		for ( int s = 0; s < 3; s++ )
+		{
+			char name[64];
+			configs[k][s].kernel = kernel;
+			configs[k][s].source = s;
+			snprintf( name, sizeof( name ), "voice_render %s %s", kernels[k], sources[s] );
+			bench_run( name, "sample", bench_voice_render, &configs[k][s] );
+		}
+	}
+
+	// JSON output
+	printf( "{\n\t\"voices\": %d,\n\t\"wavetables\": %u,\n\t\"results\": [\n", VOICE_COUNT, wavetable_index.count );
+	for ( unsigned int i = 0; i < result_count; i++ )
+	{
+		const struct bench_result *r = &results[i];
+		printf( "\t\t{\"name\": \"%s\", \"op\": \"%s\", \"ops\": %" PRIu64 ", \"ns_per_op\": %.3f, \"ops_per_sec\": %.0f}%s\n",
+			r->name, r->op, r->ops, r->ns_per_op, 1e9 / r->ns_per_op, i + 1 < result_count ? "," : "" );
+	}
+	printf( "\t]\n}\n" );
+
+	if ( baseline != NULL && bench_compare( baseline, threshold ) )
+		return 1;
+	return 0;
+}
@@ -0,0 +1,300 @@
+#include <inttypes.h>
+#include <string.h>
+#include "voice_simd.h"
+
+/**
+	\file voice_simd.c
+	\brief SSE2/AVX2 voice mixing kernels for the host
+
+	The kernels process 8 (SSE2) or 16 (AVX2) voices at once. Waveform samples are still
+	read per voice (from the slot cache or expanded cycles if possible), but the crossfade, both 1-pole
+	filters and the gain are computed on 16-bit lanes. safe_add() is exactly a saturating
+	16-bit add, so the results are bit-exact with voice_render_mix().
+
+	Voices that are off are processed as well (with zero gain), but their state is
+	never written back.
+*/
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#define VOICE_SIMD_X86
+#endif
+
+//! Maximum number of lanes
+#define VOICE_SIMD_LANES 16
+
+//! State of a group of voices processed together
+struct voice_lanes
+{
+	const uint8_t *ptr_l[VOICE_SIMD_LANES];
+	const uint8_t *ptr_r[VOICE_SIMD_LANES];
+	voice_phase phase[VOICE_SIMD_LANES];
+	voice_phase step[VOICE_SIMD_LANES];
+	int16_t factor[VOICE_SIMD_LANES] __attribute__( ( aligned( 32 ) ) );
+	int16_t gain[VOICE_SIMD_LANES] __attribute__( ( aligned( 32 ) ) );
+	int16_t fa[VOICE_SIMD_LANES] __attribute__( ( aligned( 32 ) ) );
+	int16_t fb[VOICE_SIMD_LANES] __attribute__( ( aligned( 32 ) ) );
+	int16_t sample_l[VOICE_SIMD_LANES] __attribute__( ( aligned( 32 ) ) );
+	int16_t sample_r[VOICE_SIMD_LANES] __attribute__( ( aligned( 32 ) ) );
+	uint8_t expanded;
+	uint8_t cached;
+};
+
+//! Loads state of voices v0 to v0 + lanes - 1 - returns 0 if none of them is active
+static int voice_lanes_load( struct voice_lanes *l, const struct voice_bank *bank, const struct wavetable_entry *wavetable, unsigned int v0, unsigned int lanes )
+{
+	int active = 0;
+
+	memset( l, 0, sizeof( *l ) );
+	l->expanded = bank->expanded;
+	l->cached = bank->slot_cache != NULL;
+	for ( unsigned int j = 0; j < lanes; j++ )
+	{
+		// Unused lanes read slot 0 of the wavetable with zero gain
+		uint16_t slot = 0;
+		unsigned int v = v0 + j;
+		int active_lane = v < VOICE_COUNT && bank->stage[v] != VOICE_OFF;
+
+		if ( active_lane )
+		{
+			slot = bank->slot[v];
+			l->phase[j] = bank->phase[v];
+			l->step[j] = bank->step[v];
+			l->gain[j] = bank->gain[v];
+			l->fa[j] = bank->fa[v];
+			l->fb[j] = bank->fb[v];
+			active = 1;
+		}
+
+		// Cached slot cycles are already crossfaded (factor 0 keeps sample_l as it is)
+		// Unused lanes don't touch the cache, so they can't evict anything
+		if ( l->cached )
+		{
+			static const uint8_t silence[WAVEFORM_CYCLE_SIZE];
+			l->ptr_l[j] = active_lane ? slot_cache_get( bank->slot_cache, slot ) : silence;
+			continue;
+		}
+
+		struct wavetable_entry e;
+		get_slot_entry( &e, wavetable, slot );
+		if ( l->expanded )
+		{
+			l->ptr_l[j] = get_cycle_pointer( bank->waveforms, e.wave_l );
+			l->ptr_r[j] = get_cycle_pointer( bank->waveforms, e.wave_r );
+		}
+		else
+		{
+			l->ptr_l[j] = get_waveform_pointer( bank->waveforms, e.wave_l );
+			l->ptr_r[j] = get_waveform_pointer( bank->waveforms, e.wave_r );
+		}
+		l->factor[j] = e.factor;
+	}
+
+	return active;
+}
+
+//! Writes state of the active voices back
+static void voice_lanes_store( const struct voice_lanes *l, struct voice_bank *bank, unsigned int v0, unsigned int lanes )
+{
+	for ( unsigned int j = 0; j < lanes; j++ )
+	{
+		unsigned int v = v0 + j;
+		if ( v < VOICE_COUNT && bank->stage[v] != VOICE_OFF )
+		{
+			bank->phase[v] = l->phase[j];
+			bank->fa[v] = l->fa[j];
+			bank->fb[v] = l->fb[j];
+		}
+	}
+}
+
+//! Reads waveform samples for all lanes and advances the phases
+static inline void voice_lanes_read( struct voice_lanes *l, unsigned int lanes )
+{
+	if ( l->cached )
+	{
+		for ( unsigned int j = 0; j < lanes; j++ )
+		{
+			l->sample_l[j] = get_cycle_sample_by_phase( l->ptr_l[j], VOICE_PHASE_TOP( l->phase[j] ) );
+			l->phase[j] += l->step[j];
+		}
+	}
+	else if ( l->expanded )
+	{
+		for ( unsigned int j = 0; j < lanes; j++ )
+		{
+			l->sample_l[j] = get_cycle_sample_by_phase( l->ptr_l[j], VOICE_PHASE_TOP( l->phase[j] ) );
+			l->sample_r[j] = get_cycle_sample_by_phase( l->ptr_r[j], VOICE_PHASE_TOP( l->phase[j] ) );
+			l->phase[j] += l->step[j];
+		}
+	}
+	else
+	{
+		for ( unsigned int j = 0; j < lanes; j++ )
+		{
+			l->sample_l[j] = get_waveform_sample_by_phase( l->ptr_l[j], VOICE_PHASE_TOP( l->phase[j] ) );
+			l->sample_r[j] = get_waveform_sample_by_phase( l->ptr_r[j], VOICE_PHASE_TOP( l->phase[j] ) );
+			l->phase[j] += l->step[j];
+		}
+	}
+}
+
+#ifdef VOICE_SIMD_X86
+
+//! Signed division by 256 rounding towards zero (like C division)
+static inline __m128i sse2_div256( __m128i x )
+{
+	__m128i bias = _mm_srli_epi16( _mm_srai_epi16( x, 15 ), 8 );
+	return _mm_srai_epi16( _mm_add_epi16( x, bias ), 8 );
+}
+
+//! 1-pole filter (filter1pole_feed()) on 8 lanes
+static inline __m128i sse2_filter1pole_feed( __m128i *f, __m128i k, __m128i x )
+{
+	*f = _mm_adds_epi16( *f, _mm_mullo_epi16( _mm_sub_epi16( x, sse2_div256( *f ) ), k ) );
+	return sse2_div256( *f );
+}
+
+//! SSE2 kernel - 8 voices at once
+void voice_render_mix_sse2( struct voice_bank *bank, const struct wavetable_entry *wavetable, voice_mix *mix, uint8_t n )
+{
+	struct voice_lanes l;
+	__m128i k = _mm_set1_epi16( bank->k );
+	__m128i c127 = _mm_set1_epi16( 127 );
+	__m128i c256 = _mm_set1_epi16( 256 );
+	__m128i ones = _mm_set1_epi16( 1 );
+
+	for ( unsigned int v0 = 0; v0 < VOICE_COUNT; v0 += 8 )
+	{
+		if ( !voice_lanes_load( &l, bank, wavetable, v0, 8 ) ) continue;
+
+		__m128i factor = _mm_load_si128( (__m128i*) l.factor );
+		__m128i factor_l = _mm_sub_epi16( c256, factor );
+		__m128i gain = _mm_load_si128( (__m128i*) l.gain );
+		__m128i fa = _mm_load_si128( (__m128i*) l.fa );
+		__m128i fb = _mm_load_si128( (__m128i*) l.fb );
+
+		for ( uint8_t i = 0; i < n; i++ )
+		{
+			voice_lanes_read( &l, 8 );
+			__m128i sample_l = _mm_load_si128( (__m128i*) l.sample_l );
+			__m128i sample_r = _mm_load_si128( (__m128i*) l.sample_r );
+
+			// Crossfade (get_wavetable_sample()) - the products fit in 16 unsigned bits
+			__m128i sample = _mm_srli_epi16( _mm_add_epi16( _mm_mullo_epi16( factor_l, sample_l ), _mm_mullo_epi16( factor, sample_r ) ), 8 );
+
+			// Conversion to audio_signal (int8_t)
+			__m128i x = _mm_srai_epi16( _mm_slli_epi16( _mm_sub_epi16( sample, c127 ), 8 ), 8 );
+
+			// Filters and gain
+			__m128i y = sse2_filter1pole_feed( &fb, k, sse2_filter1pole_feed( &fa, k, x ) );
+			y = _mm_srai_epi16( _mm_mullo_epi16( y, gain ), 8 );
+
+			// Sum of all lanes
+			__m128i sum = _mm_madd_epi16( y, ones );
+			sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+			sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+			mix[i] += _mm_cvtsi128_si32( sum );
+		}
+
+		_mm_store_si128( (__m128i*) l.fa, fa );
+		_mm_store_si128( (__m128i*) l.fb, fb );
+		voice_lanes_store( &l, bank, v0, 8 );
+	}
+}
+
+//! Signed division by 256 rounding towards zero (like C division)
+__attribute__( ( target( "avx2" ) ) )
+static inline __m256i avx2_div256( __m256i x )
+{
+	__m256i bias = _mm256_srli_epi16( _mm256_srai_epi16( x, 15 ), 8 );
+	return _mm256_srai_epi16( _mm256_add_epi16( x, bias ), 8 );
+}
+
+//! 1-pole filter (filter1pole_feed()) on 16 lanes
+__attribute__( ( target( "avx2" ) ) )
+static inline __m256i avx2_filter1pole_feed( __m256i *f, __m256i k, __m256i x )
+{
+	*f = _mm256_adds_epi16( *f, _mm256_mullo_epi16( _mm256_sub_epi16( x, avx2_div256( *f ) ), k ) );
+	return avx2_div256( *f );
+}
+
+//! AVX2 kernel - 16 voices at once
+__attribute__( ( target( "avx2" ) ) )
+void voice_render_mix_avx2( struct voice_bank *bank, const struct wavetable_entry *wavetable, voice_mix *mix, uint8_t n )
+{
+	struct voice_lanes l;
+	__m256i k = _mm256_set1_epi16( bank->k );
+	__m256i c127 = _mm256_set1_epi16( 127 );
+	__m256i c256 = _mm256_set1_epi16( 256 );
+	__m256i ones = _mm256_set1_epi16( 1 );
+
+	for ( unsigned int v0 = 0; v0 < VOICE_COUNT; v0 += 16 )
+	{
+		if ( !voice_lanes_load( &l, bank, wavetable, v0, 16 ) ) continue;
+
+		__m256i factor = _mm256_load_si256( (__m256i*) l.factor );
+		__m256i factor_l = _mm256_sub_epi16( c256, factor );
+		__m256i gain = _mm256_load_si256( (__m256i*) l.gain );
+		__m256i fa = _mm256_load_si256( (__m256i*) l.fa );
+		__m256i fb = _mm256_load_si256( (__m256i*) l.fb );
+
+		for ( uint8_t i = 0; i < n; i++ )
+		{
+			voice_lanes_read( &l, 16 );
+			__m256i sample_l = _mm256_load_si256( (__m256i*) l.sample_l );
+			__m256i sample_r = _mm256_load_si256( (__m256i*) l.sample_r );
+
+			// Crossfade (get_wavetable_sample()) - the products fit in 16 unsigned bits
+			__m256i sample = _mm256_srli_epi16( _mm256_add_epi16( _mm256_mullo_epi16( factor_l, sample_l ), _mm256_mullo_epi16( factor, sample_r ) ), 8 );
+
+			// Conversion to audio_signal (int8_t)
+			__m256i x = _mm256_srai_epi16( _mm256_slli_epi16( _mm256_sub_epi16( sample, c127 ), 8 ), 8 );
+
+			// Filters and gain
+			__m256i y = avx2_filter1pole_feed( &fb, k, avx2_filter1pole_feed( &fa, k, x ) );
+			y = _mm256_srai_epi16( _mm256_mullo_epi16( y, gain ), 8 );
+
+			// Sum of all lanes
+			__m256i sum8 = _mm256_madd_epi16( y, ones );
+			__m128i sum = _mm_add_epi32( _mm256_castsi256_si128( sum8 ), _mm256_extracti128_si256( sum8, 1 ) );
+			sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+			sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+			mix[i] += _mm_cvtsi128_si32( sum );
+		}
+
+		_mm256_store_si256( (__m256i*) l.fa, fa );
+		_mm256_store_si256( (__m256i*) l.fb, fb );
+		voice_lanes_store( &l, bank, v0, 16 );
+	}
+}
+
+#endif
+
+/**
+	Returns a voice mixing kernel by name ("scalar", "sse2" or "avx2").
+	If name is NULL, the best kernel supported by this CPU is returned.
+	\returns NULL if the requested kernel is not available
+*/
+voice_kernel voice_simd_kernel( const char *name )
+{
+#ifdef VOICE_SIMD_X86
+	__builtin_cpu_init( );
+	int avx2 = __builtin_cpu_supports( "avx2" );
+	int sse2 = __builtin_cpu_supports( "sse2" );
+
+	if ( name == NULL )
+		return avx2 ? voice_render_mix_avx2 : sse2 ? voice_render_mix_sse2 : voice_render_mix;
+	if ( !strcmp( name, "avx2" ) )
+		return avx2 ? voice_render_mix_avx2 : NULL;
+	if ( !strcmp( name, "sse2" ) )
+		return sse2 ? voice_render_mix_sse2 : NULL;
+#else
+	if ( name == NULL )
+		return voice_render_mix;
+#endif
+
+	if ( !strcmp( name, "scalar" ) )
+		return voice_render_mix;
+	return NULL;
+}
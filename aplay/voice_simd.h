@@ -0,0 +1,12 @@
+#ifndef VOICE_SIMD_H
+#define VOICE_SIMD_H
+#include "../src/voice.h"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+extern void voice_render_mix_sse2( struct voice_bank *bank, const struct wavetable_entry *wavetable, voice_mix *mix, uint8_t n );
+extern void voice_render_mix_avx2( struct voice_bank *bank, const struct wavetable_entry *wavetable, voice_mix *mix, uint8_t n );
+#endif
+
+extern voice_kernel voice_simd_kernel( const char *name );
+
+#endif
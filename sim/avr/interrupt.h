@@ -0,0 +1,19 @@
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+#include <avr/io.h>
+
+/**
+	\file avr/interrupt.h
+	\brief Interrupts for the firmware simulator
+
+	Interrupt handlers become plain functions called by the simulator (see sim.c).
+	They're never nested, so ISR_NOBLOCK has no effect.
+*/
+
+#define ISR( vector, ... ) void vector( void )
+#define ISR_NOBLOCK
+
+#define sei( ) ( SREG |= 1 << SREG_I )
+#define cli( ) ( SREG &= ~( 1 << SREG_I ) )
+
+#endif
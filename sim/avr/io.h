@@ -0,0 +1,79 @@
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+#include <inttypes.h>
+
+/**
+	\file avr/io.h
+	\brief ATmega32 registers for the firmware simulator
+
+	The registers used by the firmware are plain variables defined in sim.c. The simulator
+	updates the ones driven by the hardware (TCNT1, TIFR, UDR, UCSRA, ADCH) before it calls
+	an interrupt handler, reads PORTC after the timer interrupt and UDR after the main loop
+	writes it.
+*/
+
+#define SIM_REG8( name ) extern volatile uint8_t name;
+#define SIM_REG16( name ) extern volatile uint16_t name;
+
+// Ports
+SIM_REG8( PORTB )
+SIM_REG8( DDRB )
+SIM_REG8( PORTC )
+SIM_REG8( DDRC )
+
+// Status register and reset flags
+SIM_REG8( SREG )
+SIM_REG8( MCUSR )
+#define SREG_I 7
+
+// ADC
+SIM_REG8( ADMUX )
+SIM_REG8( ADCSRA )
+SIM_REG8( ADCH )
+SIM_REG8( ADCL )
+SIM_REG8( SFIOR )
+#define MUX0 0
+#define ADLAR 5
+#define REFS0 6
+#define ADPS0 0
+#define ADIE 3
+#define ADIF 4
+#define ADATE 5
+#define ADSC 6
+#define ADEN 7
+#define ADTS0 5
+
+// USART - UDR is wider than the real register, so that the simulator can tell a written byte
+// from an empty register (SIM_UDR_EMPTY)
+SIM_REG16( UDR )
+SIM_REG8( UCSRA )
+SIM_REG8( UCSRB )
+SIM_REG8( UCSRC )
+SIM_REG8( UBRRH )
+SIM_REG8( UBRRL )
+#define DOR 3
+#define FE 4
+#define UDRE 5
+#define TXC 6
+#define RXC 7
+#define TXEN 3
+#define RXEN 4
+#define UDRIE 5
+#define RXCIE 7
+#define UCSZ0 1
+#define USBS 3
+#define URSEL 7
+
+// Timer 1
+SIM_REG8( TCCR1A )
+SIM_REG8( TCCR1B )
+SIM_REG8( TIMSK )
+SIM_REG8( TIFR )
+SIM_REG16( TCNT1 )
+SIM_REG16( OCR1A )
+#define CS10 0
+#define WGM12 3
+#define OCIE1A 4
+#define OCF1A 4
+
+#endif
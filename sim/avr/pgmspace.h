@@ -0,0 +1,15 @@
+#ifndef SIM_AVR_PGMSPACE_H
+#define SIM_AVR_PGMSPACE_H
+#include <inttypes.h>
+
+/**
+	\file avr/pgmspace.h
+	\brief Program memory for the firmware simulator - PROGMEM data are plain const arrays
+*/
+
+#define PROGMEM
+
+#define pgm_read_byte( ptr ) ( *(const uint8_t *)( ptr ) )
+#define pgm_read_word( ptr ) ( *(const uint16_t *)( ptr ) )
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef SIM_AVR_WDT_H
+#define SIM_AVR_WDT_H
+#include <inttypes.h>
+
+/**
+	\file avr/wdt.h
+	\brief Watchdog for the firmware simulator - a watchdog reset ends the simulation
+*/
+
+#define WDTO_15MS 0
+
+extern void wdt_enable( uint8_t timeout );
+extern void wdt_disable( void );
+
+#endif
@@ -0,0 +1,412 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <avr/io.h>
+#include <avr/wdt.h>
+#include "../src/synth.h"
+#include "../src/com.h"
+
+/**
+	\file sim.c
+	\brief Firmware simulator
+
+	The unmodified firmware sources are built for Linux against the register stubs in this
+	directory (make sim). This file provides the registers and drives the interrupts with
+	a virtual clock counting CPU cycles:
+	 - Timer 1 compare match - every OCR1A + 1 cycles, PORTC is captured after each one
+	 - ADC conversion complete - every 13 ADC clocks, the result is the input level of
+	   the channel selected when the conversion started
+	 - USART receive complete - MIDI bytes arrive one frame (10 bits) after another
+
+	The CPU is infinitely fast - code outside of the interrupts takes no time. The main
+	loop calls synth_update() through sim_synth_update() (main.c is built with the call
+	renamed), and whenever nothing has been rendered the clock jumps to the next event.
+	This keeps the simulation deterministic and much faster than real time.
+
+	Inputs come from a text trace with one event per line ('#' starts a comment):
+	 - <time ms> adc <channel> <value> - sets the input level of an ADC channel (0-255)
+	 - <time ms> midi <byte> ...       - sends hex MIDI bytes (they're queued if the line is busy)
+	Events have to be sorted by time.
+
+	The output is raw 8-bit PORTC samples (one per timer interrupt), e.g. for aplay -r 32000.
+	Bytes transmitted by the UART can be written to another file (one byte per frame time,
+	UDRE is cleared in the meantime). A watchdog reset ends the simulation.
+
+	Usage: sim [-i trace] [-o output] [-m MIDI output] [-t duration ms]
+*/
+
+//! Registers (see avr/io.h)
+volatile uint8_t PORTB, DDRB, PORTC, DDRC;
+volatile uint8_t SREG, MCUSR;
+volatile uint8_t ADMUX, ADCSRA, ADCH, ADCL, SFIOR;
+volatile uint8_t UCSRA, UCSRB, UCSRC, UBRRH, UBRRL;
+volatile uint16_t UDR;
+volatile uint8_t TCCR1A, TCCR1B, TIMSK, TIFR;
+volatile uint16_t TCNT1, OCR1A;
+
+//! Interrupt handlers
+extern void TIMER1_COMPA_vect( void );
+extern void ADC_vect( void );
+extern void USART_RXC_vect( void );
+
+//! The firmware main() (renamed by the makefile)
+extern int firmware_main( );
+
+//! Size of the queue of MIDI bytes waiting to be received
+#define SIM_UART_QUEUE 4096
+
+//! UDR value when no byte has been written
+#define SIM_UDR_EMPTY 0x100
+
+//! Input trace event
+struct sim_event
+{
+	uint64_t time;
+	uint8_t type;
+	uint8_t channel;
+	uint8_t length;
+	uint8_t data[64];
+};
+
+enum sim_event_type
+{
+	SIM_EVENT_NONE = 0,
+	SIM_EVENT_ADC,
+	SIM_EVENT_MIDI,
+};
+
+//! Simulator state
+static struct sim
+{
+	uint64_t clock, end;
+
+	// Timer 1 and ADC - next event time (0 - not running)
+	uint64_t timer_next;
+	uint64_t adc_next;
+	uint8_t adc_channel;
+	uint8_t adc_input[8];
+
+	// Received bytes and their arrival times
+	uint64_t uart_time[SIM_UART_QUEUE];
+	uint8_t uart_data[SIM_UART_QUEUE];
+	uint16_t uart_head, uart_tail;
+	uint64_t uart_free;
+
+	// Transmitter - the end of the byte being sent (0 - idle)
+	uint64_t uart_tx_done;
+	FILE *midi_output;
+
+	// Input trace with the next event
+	FILE *trace;
+	const char *trace_path;
+	unsigned int trace_line;
+	struct sim_event event;
+
+	// Output
+	FILE *output;
+	uint64_t samples;
+	struct timespec t_start;
+} sim;
+
+// ---------------------------------------------
+
+//! Converts milliseconds to CPU cycles
+static uint64_t sim_cycles( double ms )
+{
+	return ms * F_CPU / 1000 + 0.5;
+}
+
+//! Reads the next trace event (type is SIM_EVENT_NONE at the end of the trace)
+static void sim_trace_next( )
+{
+	char line[512];
+	struct sim_event *e = &sim.event;
+	uint64_t last_time = e->time;
+
+	e->type = SIM_EVENT_NONE;
+	while ( sim.trace != NULL && fgets( line, sizeof( line ), sim.trace ) )
+	{
+		sim.trace_line++;
+		char *comment = strchr( line, '#' );
+		if ( comment != NULL ) *comment = 0;
+
+		char type[16];
+		double ms;
+		int offset;
+		if ( sscanf( line, " %lf %15s %n", &ms, type, &offset ) < 2 )
+		{
+			if ( strspn( line, " \t\r\n" ) == strlen( line ) ) continue;
+			fprintf( stderr, "sim: %s:%u: invalid event\n", sim.trace_path, sim.trace_line );
+			exit( 1 );
+		}
+
+		e->time = sim_cycles( ms );
+		if ( e->time < last_time )
+		{
+			fprintf( stderr, "sim: %s:%u: events are not sorted by time\n", sim.trace_path, sim.trace_line );
+			exit( 1 );
+		}
+
+		unsigned int a, b;
+		char *ptr = line + offset;
+		if ( !strcmp( type, "adc" ) && sscanf( ptr, "%u %u", &a, &b ) == 2 && a < 8 && b < 256 )
+		{
+			e->type = SIM_EVENT_ADC;
+			e->channel = a;
+			e->data[0] = b;
+			return;
+		}
+
+		if ( !strcmp( type, "midi" ) )
+		{
+			int n;
+			e->length = 0;
+			while ( e->length < sizeof( e->data ) && sscanf( ptr, "%x%n", &a, &n ) == 1 && a < 256 )
+			{
+				e->data[e->length++] = a;
+				ptr += n;
+			}
+
+			if ( e->length )
+			{
+				e->type = SIM_EVENT_MIDI;
+				return;
+			}
+		}
+
+		fprintf( stderr, "sim: %s:%u: invalid event\n", sim.trace_path, sim.trace_line );
+		exit( 1 );
+	}
+}
+
+//! UART frame (start, 8 data bits and stop bit) in CPU cycles
+static uint64_t sim_uart_frame( )
+{
+	return 16ULL * ( ( UBRRH << 8 | UBRRL ) + 1 ) * 10;
+}
+
+//! Applies a trace event
+static void sim_trace_apply( const struct sim_event *e )
+{
+	if ( e->type == SIM_EVENT_ADC )
+	{
+		sim.adc_input[e->channel] = e->data[0];
+		return;
+	}
+
+	// MIDI bytes are sent one after another
+	uint64_t frame = sim_uart_frame( );
+	for ( uint8_t i = 0; i < e->length; i++ )
+	{
+		if ( (uint16_t)( sim.uart_head - sim.uart_tail ) == SIM_UART_QUEUE )
+		{
+			fprintf( stderr, "sim: too many MIDI bytes queued\n" );
+			exit( 1 );
+		}
+
+		uint64_t start = sim.uart_free > e->time ? sim.uart_free : e->time;
+		sim.uart_free = start + frame;
+		sim.uart_time[sim.uart_head % SIM_UART_QUEUE] = sim.uart_free;
+		sim.uart_data[sim.uart_head % SIM_UART_QUEUE] = e->data[i];
+		sim.uart_head++;
+	}
+}
+
+// ---------------------------------------------
+
+//! Prints the statistics and ends the simulation
+static void sim_finish( const char *reason )
+{
+	struct timespec t_end;
+	clock_gettime( CLOCK_MONOTONIC, &t_end );
+	double wall = ( t_end.tv_sec - sim.t_start.tv_sec ) + ( t_end.tv_nsec - sim.t_start.tv_nsec ) * 1e-9;
+	double simulated = (double) sim.clock / F_CPU;
+
+	fflush( sim.output );
+	if ( sim.midi_output != NULL ) fflush( sim.midi_output );
+	fprintf( stderr, "sim: %s after %.3f s\n", reason, simulated );
+	fprintf( stderr, "sim: %" PRIu64 " samples, %u underruns, %u MIDI bytes lost\n", sim.samples, synth_underruns, comrxoverruns + comrxhwoverruns );
+	fprintf( stderr, "sim: %.3f s of wall time, %.0fx real time\n", wall, wall > 0 ? simulated / wall : 0 );
+	exit( 0 );
+}
+
+//! Watchdog reset
+void wdt_enable( uint8_t timeout )
+{
+	(void) timeout;
+	sim_finish( "watchdog reset" );
+}
+
+void wdt_disable( void )
+{
+}
+
+//! Advances the clock to the next event and handles it
+static void sim_step( )
+{
+	uint8_t interrupts = SREG & ( 1 << SREG_I );
+
+	// Timer 1 (CTC mode, no prescaler) and free running ADC start when they're configured
+	uint64_t timer_period = OCR1A + 1;
+	if ( !sim.timer_next && ( TCCR1B & 7 ) )
+		sim.timer_next = sim.clock + timer_period;
+
+	uint64_t adc_period = 13ULL << ( ADCSRA & 7 );
+	if ( !sim.adc_next && ( ADCSRA & ( 1 << ADEN ) ) && ( ADCSRA & ( 1 << ADSC ) ) )
+	{
+		sim.adc_channel = ADMUX & 7;
+		sim.adc_next = sim.clock + adc_period;
+	}
+
+	// The next event
+	uint64_t next = UINT64_MAX;
+	if ( sim.event.type != SIM_EVENT_NONE && sim.event.time < next ) next = sim.event.time;
+	if ( sim.timer_next && sim.timer_next < next ) next = sim.timer_next;
+	if ( sim.adc_next && sim.adc_next < next ) next = sim.adc_next;
+	if ( sim.uart_head != sim.uart_tail && sim.uart_time[sim.uart_tail % SIM_UART_QUEUE] < next )
+		next = sim.uart_time[sim.uart_tail % SIM_UART_QUEUE];
+	if ( sim.uart_tx_done && sim.uart_tx_done < next ) next = sim.uart_tx_done;
+
+	if ( next > sim.end )
+	{
+		sim.clock = sim.end;
+		sim_finish( "done" );
+	}
+
+	sim.clock = next;
+	if ( sim.timer_next ) TCNT1 = timer_period - ( sim.timer_next - sim.clock );
+
+	// Trace events
+	while ( sim.event.type != SIM_EVENT_NONE && sim.event.time <= sim.clock )
+	{
+		sim_trace_apply( &sim.event );
+		sim_trace_next( );
+	}
+
+	// Sample output
+	if ( sim.timer_next == sim.clock )
+	{
+		TIFR |= 1 << OCF1A;
+		TCNT1 = 0;
+		if ( interrupts && ( TIMSK & ( 1 << OCIE1A ) ) )
+		{
+			TIMER1_COMPA_vect( );
+			TIFR &= ~( 1 << OCF1A );
+		}
+
+		fputc( PORTC, sim.output );
+		sim.samples++;
+		sim.timer_next += timer_period;
+	}
+
+	// The next conversion uses the channel selected at the moment
+	if ( sim.adc_next == sim.clock )
+	{
+		ADCH = sim.adc_input[sim.adc_channel];
+		sim.adc_channel = ADMUX & 7;
+		if ( interrupts && ( ADCSRA & ( 1 << ADIE ) ) )
+			ADC_vect( );
+		sim.adc_next += adc_period;
+	}
+
+	// Received MIDI byte
+	if ( sim.uart_head != sim.uart_tail && sim.uart_time[sim.uart_tail % SIM_UART_QUEUE] <= sim.clock )
+	{
+		UDR = sim.uart_data[sim.uart_tail % SIM_UART_QUEUE];
+		UCSRA |= 1 << RXC;
+		sim.uart_tail++;
+		if ( interrupts && ( UCSRB & ( 1 << RXCIE ) ) )
+			USART_RXC_vect( );
+		UCSRA &= ~( 1 << RXC );
+		UDR = SIM_UDR_EMPTY;
+	}
+
+	// Transmitted byte
+	if ( sim.uart_tx_done == sim.clock )
+	{
+		UCSRA |= 1 << UDRE;
+		sim.uart_tx_done = 0;
+	}
+}
+
+//! Picks up a byte written to UDR by the firmware
+static void sim_uart_tx( )
+{
+	if ( UDR == SIM_UDR_EMPTY ) return;
+	if ( sim.midi_output != NULL ) fputc( UDR, sim.midi_output );
+	UDR = SIM_UDR_EMPTY;
+	UCSRA &= ~( 1 << UDRE );
+	sim.uart_tx_done = sim.clock + sim_uart_frame( );
+}
+
+/**
+	Called by the firmware main loop instead of synth_update() - if nothing has been
+	rendered, the firmware is waiting for the next interrupt. Bytes written to UDR in the
+	previous iteration of the main loop are transmitted first.
+*/
+uint8_t sim_synth_update( )
+{
+	sim_uart_tx( );
+	uint8_t rendered = synth_update( );
+	if ( !rendered ) sim_step( );
+	return rendered;
+}
+
+// ---------------------------------------------
+
+int main( int argc, char **argv )
+{
+	const char *output_path = NULL, *midi_output_path = NULL;
+	double duration = 1000;
+	int opt;
+
+	while ( ( opt = getopt( argc, argv, "i:o:m:t:" ) ) != -1 )
+	{
+		switch ( opt )
+		{
+			case 'i': sim.trace_path = optarg; break;
+			case 'o': output_path = optarg; break;
+			case 'm': midi_output_path = optarg; break;
+			case 't': duration = atof( optarg ); break;
+
+			default:
+				fprintf( stderr, "usage: %s [-i trace] [-o output] [-m MIDI output] [-t duration ms]\n", argv[0] );
+				return 1;
+		}
+	}
+
+	if ( sim.trace_path != NULL && ( sim.trace = fopen( sim.trace_path, "r" ) ) == NULL )
+	{
+		perror( sim.trace_path );
+		return 1;
+	}
+
+	sim.output = stdout;
+	if ( output_path != NULL && ( sim.output = fopen( output_path, "wb" ) ) == NULL )
+	{
+		perror( output_path );
+		return 1;
+	}
+
+	if ( midi_output_path != NULL && ( sim.midi_output = fopen( midi_output_path, "wb" ) ) == NULL )
+	{
+		perror( midi_output_path );
+		return 1;
+	}
+
+	// The transmitter is ready
+	UCSRA = 1 << UDRE;
+	UDR = SIM_UDR_EMPTY;
+
+	sim.end = sim_cycles( duration );
+	sim_trace_next( );
+	clock_gettime( CLOCK_MONOTONIC, &sim.t_start );
+
+	firmware_main( );
+	sim_finish( "firmware returned" );
+	return 0;
+}
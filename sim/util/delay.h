@@ -0,0 +1,19 @@
+#ifndef SIM_UTIL_DELAY_H
+#define SIM_UTIL_DELAY_H
+
+/**
+	\file util/delay.h
+	\brief Busy-wait delays for the firmware simulator - they take no simulated time
+*/
+
+static inline void _delay_ms( double ms )
+{
+	(void) ms;
+}
+
+static inline void _delay_us( double us )
+{
+	(void) us;
+}
+
+#endif
@@ -0,0 +1,49 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <inttypes.h>
+#include "adc.h"
+
+volatile uint8_t adc_values[ADC_CHANNELS];
+
+//! Smoothing accumulators (value << ADC_SMOOTH_SHIFT)
+static uint16_t adc_acc[ADC_CHANNELS];
+
+//! Channel of the conversion in progress and the channel currently selected in ADMUX
+static uint8_t adc_running = 0, adc_mux = 0;
+
+//! Selects ADC channel (VCC as reference voltage, 8-bit left adjusted result)
+static inline void adcmux( uint8_t mux )
+{
+	ADMUX = ( mux << MUX0 ) | ( 1 << REFS0 ) | ( 1 << ADLAR );
+}
+
+//! Starts free running conversions scanning all channels
+void adcinit( )
+{
+	adcmux( 0 );
+
+	// Free running mode
+	SFIOR &= ~( 7 << ADTS0 );
+
+	// Enable, start, auto trigger, interrupt, F_CPU / 128 prescaler
+	// At 16MHz this gives about 9600 conversions per second - 1200 per channel
+	ADCSRA = ( 1 << ADEN ) | ( 1 << ADSC ) | ( 1 << ADATE ) | ( 1 << ADIE ) | ( 7 << ADPS0 );
+}
+
+//! Conversion complete interrupt - can be interrupted by the audio ISR
+ISR( ADC_vect, ISR_NOBLOCK )
+{
+	// In free running mode the next conversion has already started when this interrupt fires.
+	// It uses the channel that was selected in ADMUX at that time, so a newly selected
+	// channel only applies to the conversion after it.
+	uint8_t channel = adc_running;
+	adc_running = adc_mux;
+	if ( ++adc_mux == ADC_CHANNELS ) adc_mux = 0;
+	adcmux( adc_mux );
+
+	// Exponential smoothing
+	uint16_t acc = adc_acc[channel];
+	acc += ADCH - ( acc >> ADC_SMOOTH_SHIFT );
+	adc_acc[channel] = acc;
+	adc_values[channel] = acc >> ADC_SMOOTH_SHIFT;
+}
@@ -0,0 +1,22 @@
+#ifndef ADC_H
+#define ADC_H
+#include <inttypes.h>
+
+//! Number of scanned ADC channels
+#define ADC_CHANNELS 8
+
+//! Smoothing - each new reading contributes 1/2^ADC_SMOOTH_SHIFT to the value
+#define ADC_SMOOTH_SHIFT 2
+
+//! Smoothed 8-bit readings of all ADC channels (updated by the ADC interrupt)
+extern volatile uint8_t adc_values[ADC_CHANNELS];
+
+extern void adcinit( );
+
+//! Returns the latest smoothed reading of an ADC channel - doesn't wait for anything
+static inline uint8_t adcget( uint8_t channel )
+{
+	return adc_values[channel];
+}
+
+#endif
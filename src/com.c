@@ -1,7 +1,20 @@
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <inttypes.h>
 #include "com.h"
 
+//Receive ring buffer - written by the RX interrupt, read by the main loop
+//The indices are free running, so head - tail is the number of buffered bytes
+static volatile uint8_t rxbuf[COM_RX_BUFFER_SIZE];
+static volatile uint8_t rxhead = 0;
+static volatile uint8_t rxtail = 0;
+
+//Bytes lost because the ring buffer was full
+volatile uint16_t comrxoverruns = 0;
+
+//Bytes lost because the UART hardware buffer overran (DOR)
+volatile uint16_t comrxhwoverruns = 0;
+
 //Initialize USART
 void cominit( uint32_t baud )
 {
@@ -10,20 +23,50 @@ void cominit( uint32_t baud )
 	UBRRH = (unsigned char) ( baud >> 8 ); //Set baud rate
     UBRRL = (unsigned char) baud;
 
-    UCSRB = ( 1 << RXEN ) | ( 1 << TXEN ); //Enable RX and TX
+    UCSRB = ( 1 << RXEN ) | ( 1 << TXEN ) | ( 1 << RXCIE ); //Enable RX, TX and RX interrupt
     UCSRC = ( 1 << URSEL ) | ( 0 << USBS ) | ( 3 << UCSZ0 ); //Set data format - 8 bit data, 1 stop
 }
 
+//Receive complete interrupt
+ISR( USART_RXC_vect )
+{
+	//Status has to be read before the data register
+	uint8_t status = UCSRA;
+	uint8_t b = UDR;
+	uint8_t head = rxhead;
+
+	if ( status & ( 1 << DOR ) ) comrxhwoverruns++;
+
+	if ( (uint8_t)( head - rxtail ) == COM_RX_BUFFER_SIZE )
+	{
+		comrxoverruns++;
+		return;
+	}
+
+	rxbuf[head & ( COM_RX_BUFFER_SIZE - 1 )] = b;
+	rxhead = head + 1;
+}
+
+//Returns number of received bytes waiting in the buffer
 uint8_t comstatus( )
 {
-	return UCSRA & ( 1 << RXC );
+	return rxhead - rxtail;
 }
 
 //Receive character
 uint8_t comrx( )
 {
-	while ( !( UCSRA & ( 1 << RXC ) ) );
-	return UDR;
+	uint8_t tail = rxtail;
+	while ( rxhead == tail );
+	uint8_t b = rxbuf[tail & ( COM_RX_BUFFER_SIZE - 1 )];
+	rxtail = tail + 1;
+	return b;
+}
+
+//Returns 1 if a character can be transmitted without waiting
+uint8_t comtxready( )
+{
+	return ( UCSRA & ( 1 << UDRE ) ) != 0;
 }
 
 //Transmit character
@@ -3,10 +3,16 @@
 #include <avr/io.h>
 #include <inttypes.h>
 
+//Receive buffer size - has to be a power of 2, not bigger than 128
+#define COM_RX_BUFFER_SIZE 32
+
+extern volatile uint16_t comrxoverruns;
+extern volatile uint16_t comrxhwoverruns;
+
 extern void cominit( uint32_t baud );
 extern uint8_t comstatus( );
 extern uint8_t comrx( );
+extern uint8_t comtxready( );
 extern uint8_t comtx( uint8_t b );
 
 #endif
-
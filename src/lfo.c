@@ -0,0 +1,10 @@
+#include <inttypes.h>
+#include "lfo.h"
+
+//! First quarter of a sine wave - sampled in the middle of each step, so it can be mirrored
+const uint8_t lfo_sine_lut[64] ROM = {
+	  2,   5,   8,  11,  14,  17,  20,  23,  26,  29,  32,  35,  38,  41,  44,  47,
+	 50,  53,  56,  58,  61,  64,  67,  69,  72,  74,  77,  79,  82,  84,  86,  89,
+	 91,  93,  95,  97,  99, 101, 103, 105, 106, 108, 110, 111, 113, 114, 115, 117,
+	118, 119, 120, 121, 122, 123, 124, 124, 125, 125, 126, 126, 127, 127, 127, 127,
+};
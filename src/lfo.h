@@ -0,0 +1,102 @@
+#ifndef LFO_H
+#define LFO_H
+#include <inttypes.h>
+#include "rom.h"
+
+/**
+	\file lfo.h
+	\brief Fixed-point LFO
+
+	The LFO is driven by a 16-bit DDS phase accumulator and is meant to be updated
+	at control rate (not for every sample). The output is a signed value in range -127..127.
+	Everything is done on 8/16-bit integers, so the same code runs in the AVR firmware and
+	in the host renderer.
+*/
+
+//! LFO waveform shapes
+enum lfo_shape
+{
+	LFO_SINE = 0,
+	LFO_TRIANGLE,
+	LFO_SAW,
+	LFO_SQUARE,
+	LFO_SAMPLE_HOLD,
+};
+
+//! LFO state
+struct lfo
+{
+	uint16_t phase;
+	uint16_t step;
+	uint8_t shape;
+	int8_t value;
+	uint16_t rng;
+};
+
+//! Phase step for LFO frequency given in mHz, updated control_rate times per second
+#define LFO_STEP( freq_mhz, control_rate ) \
+	( (uint16_t)( ( 65536ULL * ( freq_mhz ) + 500ULL * ( control_rate ) ) / ( 1000ULL * ( control_rate ) ) ) )
+
+//! Quarter of the sine wave (64 samples)
+extern const uint8_t lfo_sine_lut[64] ROM;
+
+//! Returns sine value for 8-bit phase
+static inline int8_t lfo_sine( uint8_t phase )
+{
+	uint8_t index = phase & 63;
+	if ( phase & 64 ) index = 63 - index;
+	int8_t value = rom_read_byte( lfo_sine_lut + index );
+	return ( phase & 128 ) ? -value : value;
+}
+
+//! Advances the LFO phase and computes new output value
+static inline int8_t lfo_update( struct lfo *lfo )
+{
+	uint16_t last_phase = lfo->phase;
+	lfo->phase += lfo->step;
+	uint8_t phase = lfo->phase >> 8;
+
+	switch ( lfo->shape )
+	{
+		case LFO_SINE:
+			lfo->value = lfo_sine( phase );
+			break;
+
+		case LFO_TRIANGLE:
+			lfo->value = ( ( phase & 128 ) ? 255 - phase : phase ) * 2 - 127;
+			break;
+
+		case LFO_SAW:
+			lfo->value = phase == 0 ? -127 : (int8_t)( phase - 128 );
+			break;
+
+		case LFO_SQUARE:
+			lfo->value = ( phase & 128 ) ? -127 : 127;
+			break;
+
+		// New random value on each phase wrap (16-bit Galois LFSR)
+		case LFO_SAMPLE_HOLD:
+			if ( lfo->phase < last_phase || !lfo->rng )
+			{
+				if ( !lfo->rng ) lfo->rng = 0xace1;
+				lfo->rng = ( lfo->rng >> 1 ) ^ ( -( lfo->rng & 1u ) & 0xb400u );
+				lfo->value = (int8_t)( lfo->rng >> 8 );
+				if ( lfo->value == -128 ) lfo->value = -127;
+			}
+			break;
+
+		default:
+			lfo->value = 0;
+			break;
+	}
+
+	return lfo->value;
+}
+
+//! Scales the LFO output by depth (0-255) - returns a value in range -127..127
+static inline int8_t lfo_scale( int8_t value, uint8_t depth )
+{
+	return ( value * depth ) >> 8;
+}
+
+#endif
@@ -5,8 +5,12 @@
 #include <util/delay.h>
 
 #include "com.h"
+#include "adc.h"
 #include "midi.h"
 #include "synth.h"
+#ifdef SYNTH_LOAD_METER
+#include "telemetry.h"
+#endif
 
 //! Midi channel
 struct midistatus midi0 = {0};
@@ -50,8 +54,15 @@ int main( )
 	// Init MIDI (UART)
 	cominit( 31250 );
 
+	// Init ADC (scanned in the background)
+	adcinit( );
+
 	// Init synthesizer state
 	synth_init( );
+	uint8_t program = midi0.program = SYNTH_DEFAULT_WAVETABLE;
+	midi0.pitchbend = 8192;
+	midi0.noteon_handler = synth_note_on;
+	midi0.noteoff_handler = synth_note_off;
 
 	// Timer 1 generates interrupts with sampling rate frequency
 	// fs = F_CPU / 1000
@@ -65,12 +76,30 @@ int main( )
 	sei( );
 
 	// The main loop (synchronous)
-	// The sound is generated inside an interrupt (handled in synth.c)
+	// The sound is rendered here in blocks and played back by an interrupt (handled in synth.c)
 	while ( 1 )
 	{
-		// Receive MIDI command and handle reset
-		if ( comstatus( ) ) midiproc( &midi0, UDR, 0 );
+		// Render audio if there's space in the buffer
+		synth_update( );
+
+		// Receive MIDI commands (buffered by the UART interrupt) and handle reset
+		while ( comstatus( ) ) midiproc( &midi0, comrx( ), 0 );
 		if ( midi0.reset ) reset( );
+
+		// Program change selects the wavetable
+		if ( midi0.program != program && synth_load_wavetable( midi0.program ) )
+			program = midi0.program;
+
+		// Modulation wheel controls wavetable slot LFO depth
+		synth_set_lfo_depth( midi0.controllers.modulation << 1 );
+
+		// Pitch bend is applied by the renderer once per block
+		synth_set_pitch_bend( midi0.pitchbend );
+
+#ifdef SYNTH_LOAD_METER
+		// Load meter frames go out over the MIDI output
+		telemetry_update( );
+#endif
 	}
 
 	return 0;
@@ -69,17 +69,25 @@ void midiproc( struct midistatus *midi, uint8_t byte, uint8_t channel )
 		{
 			switch ( status )
 			{
-				//Note on
+				//Note on (velocity 0 means note off)
 				case 0x10:
-					midi->note = midi->dbuf[0];
-					midi->notevel = midi->dbuf[1];
-					midi->noteon = 1;
-					break;
+					if ( midi->dbuf[1] != 0 )
+					{
+						midi->note = midi->dbuf[0];
+						midi->notevel = midi->dbuf[1];
+						midi->noteon = 1;
+						if ( midi->noteon_handler != NULL )
+							midi->noteon_handler( midi->dbuf[0], midi->dbuf[1] );
+						break;
+					}
+					//Fall through
 
 				//Note off
 				case 0x00:
 					if ( midi->note == midi->dbuf[0] )
 						midi->noteon = 0;
+					if ( midi->noteoff_handler != NULL )
+						midi->noteoff_handler( midi->dbuf[0] );
 					break;
 
 				//Controller change
@@ -19,6 +19,10 @@ struct midistatus
 	uint16_t pitchbend;
 	uint8_t reset;
 
+	// Note event handlers (optional)
+	void ( *noteon_handler )( uint8_t note, uint8_t velocity );
+	void ( *noteoff_handler )( uint8_t note );
+
 	// The controller represented by a union of an array and aliases
 	union
 	{
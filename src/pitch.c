@@ -0,0 +1,65 @@
+#include <inttypes.h>
+#include "pitch.h"
+
+//! 2^(x/12) for one octave, scaled by 32768 and rounded - a line per semitone
+//! (exact integers, so every toolchain builds the same table - see tools/pitchreport.c)
+const uint16_t pitch_lut[PITCH_LUT_SIZE] ROM = {
+	32768, 32887, 33005, 33125, 33245, 33365, 33486, 33607, 33728, 33850, 33973, 34095, 34219, 34343, 34467, 34591,
+	34716, 34842, 34968, 35095, 35221, 35349, 35477, 35605, 35734, 35863, 35993, 36123, 36254, 36385, 36516, 36648,
+	36781, 36914, 37047, 37181, 37316, 37451, 37586, 37722, 37859, 37996, 38133, 38271, 38409, 38548, 38688, 38828,
+	38968, 39109, 39250, 39392, 39535, 39678, 39821, 39965, 40110, 40255, 40400, 40547, 40693, 40840, 40988, 41136,
+	41285, 41434, 41584, 41735, 41886, 42037, 42189, 42342, 42495, 42649, 42803, 42958, 43113, 43269, 43425, 43582,
+	43740, 43898, 44057, 44216, 44376, 44537, 44698, 44859, 45022, 45185, 45348, 45512, 45677, 45842, 46008, 46174,
+	46341, 46509, 46677, 46846, 47015, 47185, 47356, 47527, 47699, 47871, 48044, 48218, 48393, 48568, 48743, 48920,
+	49097, 49274, 49452, 49631, 49811, 49991, 50172, 50353, 50535, 50718, 50901, 51085, 51270, 51456, 51642, 51829,
+	52016, 52204, 52393, 52582, 52773, 52963, 53155, 53347, 53540, 53734, 53928, 54123, 54319, 54515, 54713, 54910,
+	55109, 55308, 55508, 55709, 55911, 56113, 56316, 56519, 56724, 56929, 57135, 57341, 57549, 57757, 57966, 58176,
+	58386, 58597, 58809, 59022, 59235, 59449, 59664, 59880, 60097, 60314, 60532, 60751, 60971, 61191, 61413, 61635,
+	61858, 62081, 62306, 62531, 62757, 62984, 63212, 63441, 63670, 63901, 64132, 64364, 64596, 64830, 65065, 65300,
+};
+
+/**
+	Returns base * 2^(pitch/12 - 10) * 2^(25 - shift) (rounded) - so shift 25 gives
+	16-bit DDS phase step and 17 gives 24-bit one.
+*/
+static uint32_t pitch_scale( uint16_t pitch, uint16_t base, uint8_t shift )
+{
+	if ( pitch > PITCH_MAX ) pitch = PITCH_MAX;
+
+	// Octave and semitone (no division)
+	uint8_t note = pitch >> 8, octave = 0;
+	while ( note >= 12 )
+	{
+		note -= 12;
+		octave++;
+	}
+
+	// Interpolated table value - the entry following the last one (65536) is
+	// obtained through the 16-bit wrap-around
+	uint8_t i = note * PITCH_LUT_STEPS + ( (uint8_t) pitch >> 4 );
+	uint16_t a = rom_read_word( pitch_lut + i );
+	uint16_t d = ( i == PITCH_LUT_SIZE - 1 ? 0 : rom_read_word( pitch_lut + i + 1 ) ) - a;
+	uint16_t m = a + ( ( d * ( pitch & 15 ) ) >> 4 );
+
+	// The base is the step of octave 10
+	shift -= octave;
+	return ( (uint32_t) base * m + ( 1UL << ( shift - 1 ) ) ) >> shift;
+}
+
+/**
+	Returns 16-bit DDS phase step for a pitch
+	\param base is PITCH_BASE() for the sample rate
+*/
+uint16_t pitch_step( uint16_t pitch, uint16_t base )
+{
+	return pitch_scale( pitch, base, 25 );
+}
+
+/**
+	Returns 24-bit DDS phase step for a pitch (more precise in the low octaves)
+	\param base is PITCH_BASE() for the sample rate
+*/
+uint32_t pitch_step24( uint16_t pitch, uint16_t base )
+{
+	return pitch_scale( pitch, base, 17 );
+}
@@ -0,0 +1,53 @@
+#ifndef PITCH_H
+#define PITCH_H
+#include <inttypes.h>
+#include "rom.h"
+
+/**
+	\file pitch.h
+	\brief Exponential pitch to DDS phase step conversion
+
+	Pitch is represented in 1/256 of a semitone - MIDI note number in the upper byte and
+	fine tune in the lower one (see PITCH()). The phase step is looked up in a table of
+	2^(x/12) over one octave with 16 entries per semitone (linearly interpolated in between)
+	and shifted by the octave, so no floating point and no division is needed.
+
+	The table is computed by the compiler (see pitch.c). The remaining error comes from the
+	16-bit table entries and PITCH_BASE() rounding (under 0.1 cent) and from the rounding of
+	the phase step itself, which dominates in the low octaves of a 16-bit DDS
+	(make pitch-report prints the error per octave).
+*/
+
+//! Table entries per semitone and the table size (one octave)
+#define PITCH_LUT_STEPS 16
+#define PITCH_LUT_SIZE ( 12 * PITCH_LUT_STEPS )
+
+//! Pitch of a MIDI note
+#define PITCH( note ) ( (uint16_t)( note ) << 8 )
+
+//! Highest pitch handled (just below MIDI note 128)
+#define PITCH_MAX ( PITCH( 128 ) - 1 )
+
+//! 16-bit DDS phase step of MIDI note 120 (8372.018 Hz) - the reference for pitch_step()
+#define PITCH_BASE( samplerate ) \
+	( (uint16_t)( ( 65536ULL * 8372018 + 500ULL * ( samplerate ) ) / ( 1000ULL * ( samplerate ) ) ) )
+
+//! 2^(x/12) for one octave in Q15 (32768 - 65535)
+extern const uint16_t pitch_lut[PITCH_LUT_SIZE] ROM;
+
+/**
+	Applies 14-bit MIDI pitch bend (8192 is the center) to a pitch
+	\param range is the bend range in semitones
+*/
+static inline uint16_t pitch_bend( uint16_t pitch, uint16_t bend, uint8_t range )
+{
+	int32_t p = pitch + ( ( (int32_t) bend - 8192 ) * range >> 5 );
+	if ( p < 0 ) return 0;
+	if ( p > PITCH_MAX ) return PITCH_MAX;
+	return p;
+}
+
+extern uint16_t pitch_step( uint16_t pitch, uint16_t base );
+extern uint32_t pitch_step24( uint16_t pitch, uint16_t base );
+
+#endif
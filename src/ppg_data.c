@@ -774,6 +774,8 @@ const uint8_t ppg_wavetable[] PROGMEM = {
 	0xf7,
 };
 
+const uint16_t ppg_wavetable_size = sizeof( ppg_wavetable );
+
 
 const uint8_t ppg_waveforms[] PROGMEM = {
 	131,	// -------- wave 000 (00h), sample 00
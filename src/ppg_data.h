@@ -5,6 +5,11 @@
 #include <avr/pgmspace.h>
 
 extern const uint8_t ppg_wavetable[] PROGMEM;
+extern const uint16_t ppg_wavetable_size;
 extern const uint8_t ppg_waveforms[] PROGMEM;
 
+//! Packed waveforms generated by tools/ppgdata -z (see wavepack.h)
+extern const uint16_t ppg_packed_index[] PROGMEM;
+extern const uint8_t ppg_packed_waves[] PROGMEM;
+
 #endif
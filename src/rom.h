@@ -0,0 +1,46 @@
+#ifndef ROM_H
+#define ROM_H
+#include <inttypes.h>
+
+/**
+	\file rom.h
+	\brief Read-only data access abstraction
+
+	Constant tables live in flash on the AVR and have to be read with pgm_read_*().
+	On Linux the same tables are plain const arrays. Code shared between the firmware
+	and the host tools should declare such tables with ROM and read them using
+	rom_read_byte() and rom_read_word().
+*/
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+
+#define ROM PROGMEM
+
+static inline uint8_t rom_read_byte( const uint8_t *ptr )
+{
+	return pgm_read_byte( ptr );
+}
+
+static inline uint16_t rom_read_word( const uint16_t *ptr )
+{
+	return pgm_read_word( ptr );
+}
+
+#else
+
+#define ROM
+
+static inline uint8_t rom_read_byte( const uint8_t *ptr )
+{
+	return *ptr;
+}
+
+static inline uint16_t rom_read_word( const uint16_t *ptr )
+{
+	return *ptr;
+}
+
+#endif
+
+#endif
@@ -2,231 +2,385 @@
 #include <string.h>
 #include "ppg_data.h"
 #include "synth.h"
+#include "synth_core.h"
+#include "lfo.h"
+#include "adc.h"
+#include "voice.h"
+#include "pitch.h"
+#ifdef SYNTH_PACKED_WAVES
+#include "wavepack.h"
+#endif
+
+//! Two wavetable buffers - one is being played, the other one can be prepared in the meantime
+//! (3 bytes per slot - see struct wavetable_entry)
+static struct wavetable_entry wavetable_buffers[2][DEFAULT_WAVETABLE_SIZE];
 
-//! Wavetable entry struct
-struct wavetable_entry
+//! Currently used wavetable
+static struct wavetable_entry *current_wavetable = wavetable_buffers[0];
+
+#ifdef SYNTH_SLOT_CACHE
+//! Crossfaded cycles of the current wavetable - emptied on every wavetable swap
+static struct slot_cache slot_cache;
+#endif
+
+//! Wavetable waiting to be swapped in by the renderer (NULL if there's none)
+static struct wavetable_entry *pending_wavetable = NULL;
+
+//! Index of the buffer that can be written
+static uint8_t back_buffer = 1;
+
+//! Wavetable index - built on startup
+static struct wavetable_index wavetable_index;
+
+//! Wavetable switching statistics
+struct synth_wavetable_stats synth_wavetable_stats;
+
+//! Rendering statistics
+struct synth_render_stats synth_render_stats;
+
+//! Load meter statistics
+struct synth_load_stats synth_load_stats;
+
+#ifdef SYNTH_LOAD_METER
+//! ISR load measurement - the current window is only used by the ISR, the finished one
+//! is taken over by synth_update() when isr_load_ready is set
+struct synth_isr_load
 {
-	const uint8_t *ptr_l;
-	const uint8_t *ptr_r;
-	uint8_t factor;
-	uint8_t is_key;
+	uint16_t min, max;
+	uint32_t sum;
+	uint16_t samples;
 };
 
-//! Currently used wavetable
-//! It's volatile, because the main ISR uses it
-#define DEFAULT_WAVETABLE_SIZE 61
-static volatile struct wavetable_entry current_wavetable[DEFAULT_WAVETABLE_SIZE];
+static struct synth_isr_load isr_load = {.min = UINT16_MAX};
+static struct synth_isr_load isr_load_window;
+static volatile uint8_t isr_load_ready = 0;
 
-//! Returns a pointer to the wave with certain index (that can later be passed to get_waveform_sample())
-static inline const uint8_t *get_waveform_pointer( uint8_t index )
-{
-	return ppg_waveforms + ( index << 6 );
-}
+//! Main loop idle time (since the last window)
+static uint32_t idle_start, idle_sum;
+static uint8_t idle = 0;
+#endif
 
-//! Returns a sample from a waveform by index - acts as pgm_read_byte()
-static inline uint8_t get_waveform_sample( const uint8_t *ptr, uint8_t sample )
-{
-	return pgm_read_byte( ptr + sample );
-}
+//! Output sample ring buffer - written by the renderer, read by the ISR
+//! The indices are free running, so head - tail is the number of buffered samples
+//! Blocks never wrap around, because the buffer size is a multiple of the block size
+static uint8_t sample_buffer[SYNTH_BUFFER_SIZE];
+static volatile uint8_t sample_buffer_head = 0;
+static volatile uint8_t sample_buffer_tail = 0;
 
-//! Reads sample from a 64-byte waveform buffer based on 16-bit phase value
-static inline uint8_t get_waveform_sample_by_phase( const uint8_t *ptr, uint16_t phase2b )
+//! Number of samples the ISR had nothing to output
+volatile uint16_t synth_underruns = 0;
+
+//! Sample counter (incremented by the ISR)
+static volatile uint16_t sample_clock = 0;
+
+//! Returns CPU cycle timestamp based on the sample clock and Timer 1 (wraps around)
+static uint32_t synth_timestamp( )
 {
-	// This phase ranges 0-127
-	uint8_t phase = ((uint8_t*) &phase2b)[1] >> 1;
-	uint8_t half_select = phase & 64;
-	phase &= 63; // Poor man's modulo 64
+	uint8_t sreg = SREG;
+	cli( );
+	uint16_t samples = sample_clock;
+	uint16_t tcnt = TCNT1;
 
-	// Waveform mirroring
-	if ( half_select )
-		return get_waveform_sample( ptr, phase );
-	else
-		return 255u - get_waveform_sample( ptr, 63u - phase );
+	// Compare match has occurred, but the interrupt has not been handled yet
+	if ( ( TIFR & ( 1 << OCF1A ) ) && tcnt < OCR1A / 2 )
+		samples++;
+
+	SREG = sreg;
+	return (uint32_t) samples * ( OCR1A + 1 ) + tcnt;
 }
 
-//! Reads a single sample based on a wavetable entry
-static inline uint8_t get_wavetable_entry_sample( const volatile struct wavetable_entry *e, uint16_t phase2b )
+//! CPU cycles between two timestamps - they wrap around at 65536 samples, which isn't a power of two
+static uint32_t synth_timestamp_diff( uint32_t t_end, uint32_t t_start )
 {
-	uint8_t sample_l = get_waveform_sample_by_phase( e->ptr_l, phase2b );
-	uint8_t sample_r = get_waveform_sample_by_phase( e->ptr_r, phase2b );
-	uint8_t factor = e->factor;
-	uint16_t mix_l = ( 256 - factor ) * sample_l;
-	uint16_t mix_r = factor * sample_r;
-	uint16_t mix = mix_l + mix_r;
-	return mix >> 8;
+	if ( t_end < t_start ) t_end += 65536UL * ( OCR1A + 1 );
+	return t_end - t_start;
 }
 
-//! Reads a single sample from the global wavetable
-static inline uint8_t get_current_wavetable_sample( uint8_t slot, uint16_t phase2b )
+//! Current (modulated) wavetable slot position (8.8 fixed-point)
+static uint16_t synth_slot = 0;
+
+#ifdef SYNTH_EXPANDED_WAVES
+//! Expanded key waves of the current slot
+static struct waveform_cache waveform_cache;
+static struct wavetable_entry expanded_entry;
+
+/**
+	Gets key waves of a slot position into the waveform cache (expanded or decoded if they're not there yet)
+	\returns a single-entry wavetable referring to the cached cycles
+*/
+static const struct wavetable_entry *synth_cache_slot( const struct wavetable_entry *wavetable, uint16_t position )
 {
-	return get_wavetable_entry_sample( current_wavetable + slot, phase2b );
+	struct wavetable_entry e;
+	get_slot_entry( &e, wavetable, position );
+#ifdef SYNTH_PACKED_WAVES
+	expanded_entry.wave_l = wavepack_cache_get( &waveform_cache, wavepack_record( ppg_packed_index, ppg_packed_waves, e.wave_l ), NULL );
+	expanded_entry.wave_r = wavepack_cache_get( &waveform_cache, wavepack_record( ppg_packed_index, ppg_packed_waves, e.wave_r ), NULL );
+#else
+	expanded_entry.wave_l = waveform_cache_get( &waveform_cache, get_waveform_pointer( ppg_waveforms, e.wave_l ), NULL );
+	expanded_entry.wave_r = waveform_cache_get( &waveform_cache, get_waveform_pointer( ppg_waveforms, e.wave_r ), NULL );
+#endif
+	expanded_entry.factor = e.factor;
+	return &expanded_entry;
 }
+#endif
 
-//! Custom memset() implementation for volatile memory areas
-static inline void memset_volatile( volatile void *dest, uint8_t value, size_t len )
+/**
+	Prepares n-th wavetable in the back buffer and schedules it to be swapped in
+	at the beginning of the next rendered block.
+	\returns 0 if the previous wavetable has not been swapped in yet (try again later)
+	\note Wavetable numbers out of range are ignored (and reported as handled)
+*/
+uint8_t synth_load_wavetable( uint8_t n )
 {
-	for ( volatile uint8_t *ptr = dest; ptr < (volatile uint8_t*)dest + len; ptr++ )
-		*ptr = value;
+	// The renderer hasn't picked up the previous one yet
+	if ( pending_wavetable != NULL ) return 0;
+
+	const uint8_t *data = wavetable_index_get( &wavetable_index, n );
+	if ( data == NULL ) return 1;
+
+	// Build the wavetable and measure how long it takes
+	struct wavetable_entry *wavetable = wavetable_buffers[back_buffer];
+	uint32_t t_start = synth_timestamp( );
+	load_wavetable( wavetable, DEFAULT_WAVETABLE_SIZE, data );
+#ifdef SYNTH_PACKED_WAVES
+	// Nothing is rendered before the swap, so the cycles of the old wavetable can be replaced
+	synth_cache_slot( wavetable, synth_slot );
+#endif
+	synth_wavetable_stats.load_cycles = synth_timestamp_diff( synth_timestamp( ), t_start );
+
+	pending_wavetable = wavetable;
+	back_buffer ^= 1;
+	return 1;
 }
 
-
 // ---------------------------------------------
 
-// Some DSP type aliases
-typedef int8_t audio_signal;
-typedef int16_t integrator;
-typedef integrator filter1pole;
+//! The voices
+static struct voice_bank voices;
 
-//! Safe int16_t add (no overflow and underflow)
-static inline int16_t safe_add( int16_t a, int16_t b )
-{
-	if ( a > 0 && b > INT16_MAX - a )
-		return INT16_MAX;
-	else if ( a < 0 && b < INT16_MIN - a )
-		return INT16_MIN;
-	return a + b;
-}
+//! Pitch bend (14-bit, 8192 - center) - the applied value is updated by the renderer
+static uint16_t pitch_bend_value = 8192;
+static uint16_t pitch_bend_applied = 8192;
 
-// A 16-bit overflow/underflow-safe digital integrator
-static inline integrator integrator_feed( integrator *i, integrator x )
+//! Returns DDS phase step for a MIDI note with the current pitch bend
+static voice_phase synth_note_step( uint8_t note )
 {
-	return *i = safe_add( *i, x );
-	// return *i += x;
+	return voice_pitch_step( pitch_bend( PITCH( note ), pitch_bend_applied, SYNTH_BEND_RANGE ), PITCH_BASE( SAMPLERATE ) );
 }
 
-//! A 1 pole filter based on the above integrator
-//! \see integrator
-static inline audio_signal filter1pole_feed( filter1pole *f, int8_t k, audio_signal x )
+//! Sets pitch bend (14-bit MIDI value, 8192 - center)
+void synth_set_pitch_bend( uint16_t bend )
 {
-	integrator_feed( f, ( x - ( *f / 256 ) ) * k );
-	return *f / 256;
+	pitch_bend_value = bend;
 }
 
+//! Wavetable slot LFO - updated once per block
+static struct lfo slot_lfo = {.step = LFO_STEP( 2000, SYNTH_CONTROL_RATE ), .shape = LFO_SINE};
+static uint8_t slot_lfo_depth = 0;
 
-// ---------------------------------------------
+//! Slot position of an ADC reading moved by the slot LFO (not clamped yet) - the sum is widened
+//! first, because with 16-bit int (AVR) an unsigned shifted reading would make it wrap instead
+//! of going negative
+#define SYNTH_SLOT_POSITION( adc, lfo, depth ) ( ( (int32_t)( adc ) << 6 ) + (int16_t)( lfo ) * ( depth ) )
+_Static_assert( SYNTH_SLOT_POSITION( 0, -127, 255 ) < 0, "slot position sums have to be able to go negative" );
 
+//! Sets wavetable slot modulation depth (0-255)
+void synth_set_lfo_depth( uint8_t depth )
+{
+	slot_lfo_depth = depth;
+}
 
-/**
-	Load a wavetable stored in PPG Wave 2.2 format in PROGMEM into the current wavetable buffer
-	\returns a pointer to the next wavetable
-*/
-const uint8_t *load_wavetable_from_progmem( const uint8_t *data )
+//! Sets wavetable slot LFO shape and phase step (see LFO_STEP())
+void synth_set_lfo( uint8_t shape, uint16_t step )
 {
-	// Wipe the current wavetable
-	// This requires custom volatile memset
-	memset_volatile( current_wavetable, 0, DEFAULT_WAVETABLE_SIZE * sizeof( struct wavetable_entry ) );
+	slot_lfo.shape = shape;
+	slot_lfo.step = step;
+}
+
+//! Note on handler - allocates a voice
+void synth_note_on( uint8_t note, uint8_t velocity )
+{
+	voice_note_on( &voices, note, velocity, synth_note_step( note ), synth_slot );
+}
 
+//! Note off handler - releases the voice
+void synth_note_off( uint8_t note )
+{
+	voice_note_off( &voices, note );
+}
 
-	// The fist byte is ignored
-	data++;
+//! Renders a block of SYNTH_BLOCK_SIZE samples into the ring buffer
+//! Control rate work (ADC, LFO, envelopes, wavetable swap) is done once per block
+static void synth_render_block( )
+{
+	// Time counter
+	static uint16_t t_ms = 0;
+	static uint8_t t_cnt = 0;
 
-	// Read wavetable entries up to max wavetable slot number
-	uint8_t waveform, pos;
-	do
+	// Swap in the new wavetable
+	if ( pending_wavetable != NULL )
 	{
-		waveform = pgm_read_byte( data++ );
-		pos = pgm_read_byte( data++ );
-
-		current_wavetable[pos].ptr_l = get_waveform_pointer( waveform );
-		current_wavetable[pos].ptr_r = NULL;
-		current_wavetable[pos].factor = 0;
-		current_wavetable[pos].is_key = 1;
+		current_wavetable = pending_wavetable;
+		pending_wavetable = NULL;
+#ifdef SYNTH_SLOT_CACHE
+		slot_cache_init( &slot_cache, current_wavetable, ppg_waveforms, 0 );
+#endif
+		synth_wavetable_stats.swap_latency = (uint8_t)( sample_buffer_head - sample_buffer_tail );
+		synth_wavetable_stats.swap_count++;
 	}
-	while ( pos < DEFAULT_WAVETABLE_SIZE - 1 );
 
-	// Now, generate interpolation coefficients
-	volatile struct wavetable_entry *el = NULL, *er = NULL;
-	for ( uint8_t i = 0; i < DEFAULT_WAVETABLE_SIZE; i++ )
+	// Control values (scanned in the background)
+	uint8_t adc0 = adcget( 0 );
+	uint8_t adc1 = adcget( 1 );
+
+	// Modulated wavetable slot position (the ADC selects a slot every 4 steps, the LFO moves
+	// it by up to +-127 slots)
+	int32_t position = SYNTH_SLOT_POSITION( adc0, lfo_update( &slot_lfo ), slot_lfo_depth );
+	if ( position < 0 ) position = 0;
+	else if ( position > SLOT_POSITION( DEFAULT_WAVETABLE_SIZE - 1 ) ) position = SLOT_POSITION( DEFAULT_WAVETABLE_SIZE - 1 );
+	uint16_t slot = synth_slot = position;
+
+#if defined( SYNTH_SLOT_CACHE )
+	// The voices read the slot cache bound to the current wavetable
+	const struct wavetable_entry *wavetable = current_wavetable;
+#elif defined( SYNTH_EXPANDED_WAVES )
+	// Key waves of the current slot are played from expanded cycles in RAM
+	const struct wavetable_entry *wavetable = synth_cache_slot( current_wavetable, slot );
+	slot = 0;
+#else
+	const struct wavetable_entry *wavetable = current_wavetable;
+#endif
+
+	for ( uint8_t v = 0; v < VOICE_COUNT; v++ )
+		voices.slot[v] = slot;
+
+	// Retune the sounding voices if the pitch bend has changed
+	if ( pitch_bend_value != pitch_bend_applied )
 	{
-		// If the current entry contains a key-wave
-		if ( current_wavetable[i].is_key )
-		{
-			el = &current_wavetable[i];
-
-			// Look for the next key-wave
-			for ( uint8_t j = i + 1; j < DEFAULT_WAVETABLE_SIZE; j++ )
-			{
-				if ( current_wavetable[j].is_key )
-				{
-					er = &current_wavetable[j];
-					break;
-				}
-			}
-		}
+		pitch_bend_applied = pitch_bend_value;
+		for ( uint8_t v = 0; v < VOICE_COUNT; v++ )
+			if ( voices.stage[v] != VOICE_OFF )
+				voices.step[v] = synth_note_step( voices.note[v] );
+	}
 
-		// Total distance between known key-waves and distance from the left one
-		uint8_t distance_total = er - el;
-		uint8_t distance_l = &current_wavetable[i] - el;
+	// Filter coefficient and envelopes
+	voices.k = adc1 >> 1;
+	voice_control( &voices );
 
-		current_wavetable[i].ptr_l = el->ptr_l;
-		current_wavetable[i].ptr_r = er->ptr_l;
+	// The oscillators and the filters
+	uint8_t head = sample_buffer_head;
+	voice_render( &voices, wavetable, sample_buffer + ( head & ( SYNTH_BUFFER_SIZE - 1 ) ), SYNTH_BLOCK_SIZE );
 
-		// We have to avoid division by 0 for the last slot
-		if ( distance_total != 0 )
-			current_wavetable[i].factor = ( 65535 / distance_total * distance_l ) >> 8;
-		else
-			current_wavetable[i].factor = 0;
-	}
+	// Publish the block
+	sample_buffer_head = head + SYNTH_BLOCK_SIZE;
 
-	// Return pointer to the next wavetable
-	return data;
+	// Time update
+	t_cnt += SYNTH_BLOCK_SIZE;
+	if ( t_cnt >= SAMPLERATE / 1000 )
+	{
+		t_cnt -= SAMPLERATE / 1000;
+		t_ms++;
+	}
 }
 
-//! Loads n-th requested wavetable from binary format
-//! \see load_wavetable()
-const uint8_t *load_wavetable_n_from_progmem( const uint8_t *data, uint8_t index )
+#ifdef SYNTH_LOAD_METER
+//! Publishes the ISR load window finished by the ISR together with the idle time
+static void synth_load_update( )
 {
-	for ( uint8_t i = 0; i < index + 1; i++ )
-		data = load_wavetable_from_progmem( data );
-	return data;
+	uint8_t sreg = SREG;
+	cli( );
+	struct synth_isr_load w = isr_load_window;
+	isr_load_ready = 0;
+	SREG = sreg;
+
+	synth_load_stats.isr_min = w.min;
+	synth_load_stats.isr_avg = w.sum / SYNTH_LOAD_WINDOW;
+	synth_load_stats.isr_max = w.max;
+	synth_load_stats.idle_avg = idle_sum / SYNTH_LOAD_WINDOW;
+	synth_load_stats.windows++;
+	idle_sum = 0;
 }
+#endif
 
-// ---------------------------------------------
-
-static inline uint16_t adcread( uint8_t mux )
+/**
+	Renders a block of samples if there's enough space in the ring buffer.
+	Has to be called from the main loop often enough. The time the rendering takes is
+	recorded in synth_render_stats.
+	\returns 1 if a block has been rendered
+*/
+uint8_t synth_update( )
 {
-	//Read data from selected ADC (VCC as reference volatge)
-	ADMUX = ( mux << MUX0 ) | ( 1 << REFS0 ) | ( 1 << ADLAR );
-	ADCSRA |= ( 1 << ADSC );
-	while ( ADCSRA & ( 1 << ADSC ) );
-	return ADC;
-}
+#ifdef SYNTH_LOAD_METER
+	if ( isr_load_ready ) synth_load_update( );
+#endif
 
+	uint8_t buffered = sample_buffer_head - sample_buffer_tail;
+	if ( SYNTH_BUFFER_SIZE - buffered < SYNTH_BLOCK_SIZE )
+	{
+#ifdef SYNTH_LOAD_METER
+		// The main loop waits for the ISR from now on
+		if ( !idle )
+		{
+			idle_start = synth_timestamp( );
+			idle = 1;
+		}
+#endif
+		return 0;
+	}
 
-// ---------------------------------------------
-
+	uint32_t t_start = synth_timestamp( );
+#ifdef SYNTH_LOAD_METER
+	if ( idle )
+	{
+		idle_sum += synth_timestamp_diff( t_start, idle_start );
+		idle = 0;
+	}
+#endif
+	synth_render_block( );
+	uint16_t cycles = synth_timestamp( ) - t_start;
+
+	synth_render_stats.block_cycles = cycles;
+	if ( cycles > synth_render_stats.max_block_cycles )
+		synth_render_stats.max_block_cycles = cycles;
+	return 1;
+}
 
-//! The main interrupt - samples are generated here
-//! \todo replace with synchronous loop and a spinlock
+//! The sample output interrupt - only pops samples from the ring buffer
 ISR( TIMER1_COMPA_vect )
 {
-	// DDS phasor
-	static uint16_t dds_phase = 0;
-	static uint16_t dds_step = 180;
-
-	// Time counter
-	static uint16_t t_ms = 0;
-	static uint16_t t_cnt = 0;
-
-	uint8_t adc0 = adcread( 0 ) >> 8;
-	uint8_t adc1 = adcread( 1 ) >> 8;
+	uint8_t tail = sample_buffer_tail;
+	if ( tail != sample_buffer_head )
+	{
+		// DAC output
+		PORTC = sample_buffer[tail & ( SYNTH_BUFFER_SIZE - 1 )];
+		sample_buffer_tail = tail + 1;
+	}
+	else
+		synth_underruns++;
 
-	// The osicllator and the filters
-	static filter1pole Fa = 0, Fb = 0;
-	audio_signal x = get_current_wavetable_sample( adc0 >> 2, dds_phase ) - 127;
-	int8_t k = adc1 >> 1;
-	audio_signal y = filter1pole_feed( &Fb, k, filter1pole_feed( &Fa, k, x ) );
+	sample_clock++;
 
-	// DAC output
-	PORTC = 127 + y;
+#ifdef SYNTH_LOAD_METER
+	// Timer 1 is cleared by the compare match, so it has counted the cycles since the request
+	uint16_t cycles = TCNT1;
+	if ( cycles < isr_load.min ) isr_load.min = cycles;
+	if ( cycles > isr_load.max ) isr_load.max = cycles;
+	isr_load.sum += cycles;
 
-	// Phase stepping and time update
-	dds_phase += dds_step;
-	if ( ++t_cnt == SAMPLERATE / 1000 )
+	// The fields are copied one by one - struct assignments become copy loops,
+	// which tools/isrcycles can't bound
+	if ( ++isr_load.samples == SYNTH_LOAD_WINDOW )
 	{
-		t_cnt = 0;
-		t_ms++;
+		isr_load_window.min = isr_load.min;
+		isr_load_window.max = isr_load.max;
+		isr_load_window.sum = isr_load.sum;
+		isr_load_ready = 1;
+		isr_load.min = UINT16_MAX;
+		isr_load.max = 0;
+		isr_load.sum = 0;
+		isr_load.samples = 0;
 	}
+#endif
 }
 
 //! Synthesizer state init
@@ -235,9 +389,23 @@ void synth_init( )
 	// Resistor ladder outputs
 	DDRC = 0xff;
 
-	// ADC
-	ADCSRA = ( 1 << ADEN ) | ( 1 << ADPS2 );
-
-	// Load a wavetable
-	load_wavetable_n_from_progmem( ppg_wavetable, 18 );
+	// Voices
+	voice_bank_init( &voices );
+#ifdef SYNTH_EXPANDED_WAVES
+	voices.waveforms = waveform_cache.cycle[0];
+	voices.expanded = 1;
+#else
+	voices.waveforms = ppg_waveforms;
+#endif
+
+	// Index and load the default wavetable
+	wavetable_index_scan( &wavetable_index, DEFAULT_WAVETABLE_SIZE, ppg_wavetable, ppg_wavetable_size );
+	load_wavetable( current_wavetable, DEFAULT_WAVETABLE_SIZE, wavetable_index_get( &wavetable_index, SYNTH_DEFAULT_WAVETABLE ) );
+#ifdef SYNTH_SLOT_CACHE
+	slot_cache_init( &slot_cache, current_wavetable, ppg_waveforms, 0 );
+	voices.slot_cache = &slot_cache;
+#endif
+
+	// Fill the sample buffer
+	while ( synth_update( ) );
 }
@@ -1,8 +1,115 @@
 #ifndef SYNTH_H
 #define SYNTH_H
+#include <inttypes.h>
+
+//! Wavetable switching statistics
+struct synth_wavetable_stats
+{
+	uint32_t load_cycles;  //!< CPU cycles spent on building the last wavetable (including interrupts and decoding packed waves)
+	uint16_t swap_latency; //!< Samples played with the old wavetable after the last swap (buffered samples)
+	uint16_t swap_count;   //!< Number of wavetable swaps performed
+};
+
+//! Rendering statistics - block_cycles / SYNTH_BLOCK_SIZE is the cost of a sample
+struct synth_render_stats
+{
+	uint16_t block_cycles;     //!< CPU cycles spent on rendering the last block (including interrupts)
+	uint16_t max_block_cycles; //!< The longest block rendered so far
+};
+
+/**
+	Load meter (SYNTH_LOAD_METER builds) - averages over SYNTH_LOAD_WINDOW samples.
+	ISR cycles are counted from the compare match to the end of the handler body
+	(the epilogue isn't included - see make isr-cycles for the static worst case).
+*/
+struct synth_load_stats
+{
+	uint16_t isr_min;  //!< The shortest sample ISR in cycles
+	uint16_t isr_avg;  //!< Average sample ISR in cycles
+	uint16_t isr_max;  //!< The longest sample ISR in cycles
+	uint16_t idle_avg; //!< Cycles per sample the main loop spent waiting for space in the buffer (interrupts included)
+	uint16_t windows;  //!< Number of windows measured so far - incremented on every update
+};
+
+extern struct synth_wavetable_stats synth_wavetable_stats;
+extern struct synth_render_stats synth_render_stats;
+extern struct synth_load_stats synth_load_stats;
+extern volatile uint16_t synth_underruns;
 
 extern void synth_init( );
+extern uint8_t synth_update( );
+extern uint8_t synth_load_wavetable( uint8_t n );
+extern void synth_note_on( uint8_t note, uint8_t velocity );
+extern void synth_note_off( uint8_t note );
+extern void synth_set_lfo_depth( uint8_t depth );
+extern void synth_set_lfo( uint8_t shape, uint16_t step );
+extern void synth_set_pitch_bend( uint16_t bend );
 
 #define SAMPLERATE (F_CPU/500)
 
+//! Samples are rendered in blocks of SYNTH_BLOCK_SIZE into a ring buffer of SYNTH_BUFFER_SIZE bytes
+//! The buffer size has to be a power of 2, not bigger than 128
+#define SYNTH_BLOCK_SIZE 16
+#define SYNTH_BUFFER_SIZE 128
+#define SYNTH_CONTROL_RATE ( SAMPLERATE / SYNTH_BLOCK_SIZE )
+
+/**
+	Define SYNTH_EXPANDED_WAVES (e.g. in CFLAGS) to play the key waves of the current slot from
+	full 128-sample cycles expanded in SRAM (see expand_waveform()) instead of mirroring the
+	half-waves stored in flash.
+
+	RAM cost: WAVEFORM_CACHE_SIZE (2) cycles of 128 bytes plus cache bookkeeping - about 270 bytes.
+	Cycle cost: a cycle is expanded (128 flash reads) whenever the slot moves to a new key wave.
+	Gain: each of the two waveform reads per voice and sample becomes an indexed LD from RAM
+	instead of LPM preceded by the mirroring branch and two subtractions.
+*/
+//#define SYNTH_EXPANDED_WAVES
+
+/**
+	Define SYNTH_SLOT_CACHE to play the voices from crossfaded slot cycles (see struct slot_cache)
+	instead. It takes precedence over SYNTH_EXPANDED_WAVES.
+
+	RAM cost: SLOT_CACHE_SIZE (2) cycles of 128 bytes plus cache bookkeeping - about 265 bytes.
+	Cycle cost: the cache is keyed by the 8.8 slot position (adc0 << 6 plus the LFO offset), so
+	every ADC LSB change and every LFO step misses - 128 crossfaded samples are then computed in
+	that block, roughly half of the 8000-cycle block budget. With the slot LFO running this
+	happens in nearly every block.
+	Gain: a voice sample is a single indexed LD from RAM - no mirroring, no crossfade multiplies.
+	Worth it only if the slot stays put for many blocks (slot LFO depth 0 and a steady ADC).
+*/
+//#define SYNTH_SLOT_CACHE
+
+/**
+	SYNTH_PACKED_WAVES is defined by the makefile (PACKED_WAVES=1), which then links the compressed
+	waveform store generated by tools/ppgdata (see wavepack.h) instead of the raw waveforms.
+	Packed key waves are decoded into the SYNTH_EXPANDED_WAVES cache - the ones of the current slot
+	already when a wavetable is loaded, the rest when the slot moves to them.
+
+	Flash: about 4 kB less with the default error bound of 2 (see the ppgdata report).
+	Cycle cost: decoding a wave takes longer than expanding a raw one, everything else is the same.
+*/
+#ifdef SYNTH_PACKED_WAVES
+#define SYNTH_EXPANDED_WAVES
+#ifdef SYNTH_SLOT_CACHE
+#error SYNTH_SLOT_CACHE reads raw waveforms and cannot be used with SYNTH_PACKED_WAVES
+#endif
+#endif
+
+/**
+	SYNTH_LOAD_METER is defined by the makefile (LOAD_METER=1). The sample ISR then reads Timer 1
+	on exit to measure itself and the renderer measures the time it waits for the buffer - the
+	results are in synth_load_stats and telemetry_update() sends them out over the UART.
+
+	Cycle cost: about 30 cycles per sample in the ISR.
+*/
+
+//! Load meter window in samples (256 ms)
+#define SYNTH_LOAD_WINDOW 8192
+
+//! Pitch bend range in semitones
+#define SYNTH_BEND_RANGE 2
+
+//! Wavetable loaded on startup
+#define SYNTH_DEFAULT_WAVETABLE 18
+
 #endif
@@ -0,0 +1,229 @@
+#include <string.h>
+#include "synth_core.h"
+
+/**
+	Load a wavetable stored in PPG Wave 2.2 format into an array of wavetable_entry structs of size wavetable_size
+	\param data points to the wavetable data
+	\returns a pointer to the next wavetable
+	\note Key waves come in order of their positions, so slots between each pair of them
+		can be filled in as soon as the right one is read - no key flags have to be stored.
+*/
+const uint8_t *load_wavetable( struct wavetable_entry *entries, uint8_t wavetable_size, const uint8_t *data )
+{
+	// Wipe the wavetable
+	memset( entries, 0, wavetable_size * sizeof( struct wavetable_entry ) );
+
+	// The fist byte is ignored
+	data++;
+
+	// Read wavetable entries up to max wavetable slot number
+	uint8_t waveform, pos, last_waveform = 0, last_pos = 0;
+	do
+	{
+		waveform = rom_read_byte( data++ );
+		pos = rom_read_byte( data++ );
+
+		// Generate interpolation coefficients between the previous key-wave and this one
+		uint8_t distance_total = pos - last_pos;
+		for ( uint8_t distance_l = 0; distance_l < distance_total; distance_l++ )
+		{
+			struct wavetable_entry *e = &entries[last_pos + distance_l];
+			e->wave_l = last_waveform;
+			e->wave_r = waveform;
+			e->factor = ( 65535 / distance_total * distance_l ) >> 8;
+		}
+
+		// The key-wave itself (it's only overwritten if another one follows)
+		entries[pos].wave_l = waveform;
+		entries[pos].wave_r = waveform;
+		entries[pos].factor = 0;
+
+		last_waveform = waveform;
+		last_pos = pos;
+	}
+	while ( pos < wavetable_size - 1 );
+
+	// Return pointer to the next wavetable
+	return data;
+}
+
+/**
+	Validates a wavetable without decoding it
+	\returns a pointer to the next wavetable or NULL if the data is not a valid wavetable
+*/
+const uint8_t *skip_wavetable( uint8_t wavetable_size, const uint8_t *data, const uint8_t *end )
+{
+	// The fist byte is ignored
+	data++;
+
+	// Key-wave positions have to start at 0 and increase up to the last slot
+	uint8_t pos, last_pos = 0;
+	for ( uint8_t first = 1; data + 2 <= end; first = 0 )
+	{
+		data++;
+		pos = rom_read_byte( data++ );
+
+		if ( first ? pos != 0 : pos <= last_pos || pos > wavetable_size - 1 )
+			return NULL;
+		if ( pos == wavetable_size - 1 )
+			return data;
+		last_pos = pos;
+	}
+
+	return NULL;
+}
+
+/**
+	Builds wavetable index, so any wavetable can later be located in constant time
+	with wavetable_index_get(). Scanning stops on the first invalid wavetable.
+	\param size is the wavetable data size in bytes
+	\returns number of wavetables found
+*/
+uint8_t wavetable_index_scan( struct wavetable_index *index, uint8_t wavetable_size, const uint8_t *data, uint16_t size )
+{
+	const uint8_t *ptr = data, *end = data + size;
+
+	index->data = data;
+	index->count = 0;
+	while ( index->count < WAVETABLE_INDEX_SIZE && ptr < end )
+	{
+		const uint8_t *next = skip_wavetable( wavetable_size, ptr, end );
+		if ( next == NULL ) break;
+		index->offset[index->count++] = ptr - data;
+		ptr = next;
+	}
+
+	return index->count;
+}
+
+// ---------------------------------------------
+
+//! Expands a 64-byte waveform (half-wave) into a full 128-sample cycle
+void expand_waveform( uint8_t *cycle, const uint8_t *ptr )
+{
+	for ( uint8_t i = 0; i < WAVEFORM_CYCLE_SIZE; i++ )
+		cycle[i] = get_waveform_sample_by_phase( ptr, (uint16_t) i << 9 );
+}
+
+//! Empties the waveform cache
+void waveform_cache_init( struct waveform_cache *cache )
+{
+	memset( cache, 0, sizeof( *cache ) );
+}
+
+/**
+	Looks a waveform up in the cache. If it's not there, the least recently used line
+	is assigned to it and has to be filled in by the caller.
+	\param source identifies the waveform (e.g. a pointer to the waveform data)
+	\param found is set to 1 if the waveform is already in the cache and to 0 otherwise
+	\param miss is set to 1 if a cycle had to be replaced (can be NULL)
+	\returns index of the cycle
+*/
+uint8_t waveform_cache_find( struct waveform_cache *cache, const uint8_t *source, uint8_t *found, uint8_t *miss )
+{
+	uint8_t lru = 0;
+	uint16_t clock = ++cache->clock;
+
+	for ( uint8_t i = 0; i < WAVEFORM_CACHE_SIZE; i++ )
+	{
+		if ( cache->source[i] == source )
+		{
+			cache->used[i] = clock;
+			*found = 1;
+			return i;
+		}
+
+		if ( (uint16_t)( clock - cache->used[i] ) > (uint16_t)( clock - cache->used[lru] ) )
+			lru = i;
+	}
+
+	if ( miss != NULL && cache->source[lru] != NULL ) *miss = 1;
+	cache->source[lru] = source;
+	cache->used[lru] = clock;
+	*found = 0;
+	return lru;
+}
+
+/**
+	Returns index of the expanded cycle of a waveform - expands it if it's not in the cache yet,
+	replacing the least recently used one.
+	\param miss is set to 1 if a cycle had to be replaced (can be NULL)
+*/
+uint8_t waveform_cache_get( struct waveform_cache *cache, const uint8_t *ptr, uint8_t *miss )
+{
+	uint8_t found;
+	uint8_t line = waveform_cache_find( cache, ptr, &found, miss );
+	if ( !found ) expand_waveform( cache->cycle[line], ptr );
+	return line;
+}
+
+/**
+	Creates a copy of a wavetable with all key waves expanded into the cache.
+	The cache is emptied first. The copy refers to the cycles of the cache (cache->cycle).
+	\param waveforms points to the waveform data of the source wavetable
+	\returns 0 if the cache is too small to hold all key waves of the wavetable
+*/
+uint8_t expand_wavetable( struct wavetable_entry *dest, const struct wavetable_entry *src, uint8_t wavetable_size, const uint8_t *waveforms, struct waveform_cache *cache )
+{
+	uint8_t miss = 0;
+
+	waveform_cache_init( cache );
+	for ( uint8_t i = 0; i < wavetable_size; i++ )
+	{
+		dest[i].wave_l = waveform_cache_get( cache, get_waveform_pointer( waveforms, src[i].wave_l ), &miss );
+		dest[i].wave_r = waveform_cache_get( cache, get_waveform_pointer( waveforms, src[i].wave_r ), &miss );
+		dest[i].factor = src[i].factor;
+	}
+
+	return !miss;
+}
+
+// ---------------------------------------------
+
+/**
+	Empties the slot cache and binds it to a wavetable
+	\param waveforms points to the waveform data of the wavetable
+	\param expanded should be set if the wavetable refers to expanded cycles (see expand_wavetable())
+*/
+void slot_cache_init( struct slot_cache *cache, const struct wavetable_entry *wavetable, const uint8_t *waveforms, uint8_t expanded )
+{
+	memset( cache, 0, sizeof( *cache ) );
+	for ( uint8_t i = 0; i < SLOT_CACHE_SIZE; i++ )
+		cache->position[i] = SLOT_CACHE_EMPTY;
+	cache->wavetable = wavetable;
+	cache->waveforms = waveforms;
+	cache->expanded = expanded;
+}
+
+/**
+	Returns crossfaded cycle of a wavetable slot position (see get_slot_entry()) - computes
+	it if it's not in the cache yet, replacing the least recently used one.
+*/
+const uint8_t *slot_cache_get( struct slot_cache *cache, uint16_t position )
+{
+	uint8_t lru = 0;
+	uint16_t clock = ++cache->clock;
+
+	for ( uint8_t i = 0; i < SLOT_CACHE_SIZE; i++ )
+	{
+		if ( cache->position[i] == position )
+		{
+			cache->used[i] = clock;
+			return cache->cycle[i];
+		}
+
+		if ( (uint16_t)( clock - cache->used[i] ) > (uint16_t)( clock - cache->used[lru] ) )
+			lru = i;
+	}
+
+	// Only the top 7 bits of the phase matter, so one sample per 512 phase steps is enough
+	struct wavetable_entry e;
+	uint8_t *cycle = cache->cycle[lru];
+	get_slot_entry( &e, cache->wavetable, position );
+	for ( uint8_t i = 0; i < WAVEFORM_CYCLE_SIZE; i++ )
+		cycle[i] = cache->expanded ? get_expanded_wavetable_sample( cache->waveforms, &e, (uint16_t) i << 9 ) : get_wavetable_sample( cache->waveforms, &e, (uint16_t) i << 9 );
+
+	cache->position[lru] = position;
+	cache->used[lru] = clock;
+	return cycle;
+}
@@ -0,0 +1,258 @@
+#ifndef SYNTH_CORE_H
+#define SYNTH_CORE_H
+#include <stddef.h>
+#include <inttypes.h>
+#include "rom.h"
+
+/**
+	\file synth_core.h
+	\brief Synthesis kernels shared by the AVR firmware and the host tools
+
+	Waveforms and wavetables are read through rom.h, so this exact code runs in the
+	firmware ISR and can be benchmarked and profiled on Linux.
+*/
+
+//! This would be 64, but we don't need the additional 3 waveforms that PPG provides
+#define DEFAULT_WAVETABLE_SIZE 61
+
+//! Maximum number of wavetables that can be indexed
+#ifndef WAVETABLE_INDEX_SIZE
+#define WAVETABLE_INDEX_SIZE 32
+#endif
+
+/**
+	Wavetable entry struct - the slot is a crossfade between two waveforms
+
+	Waveforms are stored as indices (3 bytes per slot instead of two pointers), so the
+	waveform data they refer to has to be passed along with the wavetable. Whether a slot
+	holds a key wave only matters while the wavetable is being loaded.
+*/
+struct wavetable_entry
+{
+	uint8_t wave_l;
+	uint8_t wave_r;
+	uint8_t factor;
+};
+
+//! Returns a pointer to the wave with certain index (that can later be passed to get_waveform_sample())
+static inline const uint8_t *get_waveform_pointer( const uint8_t *waveforms, uint8_t index )
+{
+	return waveforms + ( (uint16_t) index << 6 );
+}
+
+//! Returns a sample from a waveform by index
+static inline uint8_t get_waveform_sample( const uint8_t *ptr, uint8_t sample )
+{
+	return rom_read_byte( ptr + sample );
+}
+
+//! Reads sample from a 64-byte waveform buffer based on 16-bit phase value
+static inline uint8_t get_waveform_sample_by_phase( const uint8_t *ptr, uint16_t phase2b )
+{
+	// This phase ranges 0-127
+	uint8_t phase = ((uint8_t*) &phase2b)[1] >> 1;
+	uint8_t half_select = phase & 64;
+	phase &= 63; // Poor man's modulo 64
+
+	// Waveform mirroring
+	if ( half_select )
+		return get_waveform_sample( ptr, phase );
+	else
+		return 255u - get_waveform_sample( ptr, 63u - phase );
+}
+
+//! Crossfades two samples
+static inline uint8_t crossfade( uint8_t sample_l, uint8_t sample_r, uint8_t factor )
+{
+	uint16_t mix_l = ( 256 - factor ) * sample_l;
+	uint16_t mix_r = factor * sample_r;
+	uint16_t mix = mix_l + mix_r;
+	return mix >> 8;
+}
+
+//! Reads a single sample based on a wavetable entry (waveforms points to the waveform data)
+static inline uint8_t get_wavetable_sample( const uint8_t *waveforms, const struct wavetable_entry *e, uint16_t phase2b )
+{
+	uint8_t sample_l = get_waveform_sample_by_phase( get_waveform_pointer( waveforms, e->wave_l ), phase2b );
+	uint8_t sample_r = get_waveform_sample_by_phase( get_waveform_pointer( waveforms, e->wave_r ), phase2b );
+	return crossfade( sample_l, sample_r, e->factor );
+}
+
+/**
+	Fractional slot positions
+
+	A slot position is 8.8 fixed-point (see SLOT_POSITION()), so the wavetable can be swept
+	smoothly. Neighbouring slots in between two key waves differ only in the crossfade factor,
+	so it's enough to interpolate the factor (towards 256 if the next slot starts a new pair of
+	key waves - it's the right key wave then). This is done once per block, the samples are
+	read exactly like for integer slots.
+*/
+
+//! Position of a slot
+#define SLOT_POSITION( slot ) ( (uint16_t)( slot ) << 8 )
+
+//! Computes wavetable entry for a fractional slot position (not past the last slot)
+static inline void get_slot_entry( struct wavetable_entry *dest, const struct wavetable_entry *wavetable, uint16_t position )
+{
+	const struct wavetable_entry *e = wavetable + ( position >> 8 );
+	uint8_t fraction = position;
+
+	*dest = *e;
+	if ( fraction )
+	{
+		const struct wavetable_entry *next = e + 1;
+		int16_t target = ( next->wave_l == e->wave_l && next->wave_r == e->wave_r ) ? next->factor : 256;
+		dest->factor += ( (int32_t)( target - e->factor ) * fraction ) >> 8;
+	}
+}
+
+// ---------------------------------------------
+
+/**
+	Expanded waveforms
+
+	A waveform can be expanded into a full 128-sample cycle in RAM, so reading a sample
+	is a single indexed load without mirroring. Wavetable entries referring to expanded
+	cycles (see expand_wavetable()) have to be read with get_expanded_wavetable_sample().
+	Their waveform indices refer to the cycles of a waveform cache.
+*/
+
+//! Number of samples in an expanded waveform cycle
+#define WAVEFORM_CYCLE_SIZE 128
+
+//! Number of expanded cycles held by a waveform cache
+#ifndef WAVEFORM_CACHE_SIZE
+#define WAVEFORM_CACHE_SIZE 2
+#endif
+
+#if WAVEFORM_CACHE_SIZE > 256
+#error WAVEFORM_CACHE_SIZE has to fit in a waveform index
+#endif
+
+//! Cache of expanded waveforms (least recently used cycles are replaced)
+struct waveform_cache
+{
+	const uint8_t *source[WAVEFORM_CACHE_SIZE];
+	uint16_t used[WAVEFORM_CACHE_SIZE];
+	uint16_t clock;
+	uint8_t cycle[WAVEFORM_CACHE_SIZE][WAVEFORM_CYCLE_SIZE];
+};
+
+//! Returns a pointer to the expanded cycle with certain index
+static inline const uint8_t *get_cycle_pointer( const uint8_t *cycles, uint8_t index )
+{
+	return cycles + ( (uint16_t) index << 7 );
+}
+
+//! Reads sample from an expanded 128-sample cycle (in RAM) based on 16-bit phase value
+static inline uint8_t get_cycle_sample_by_phase( const uint8_t *cycle, uint16_t phase2b )
+{
+	return cycle[((uint8_t*) &phase2b)[1] >> 1];
+}
+
+//! Reads a single sample based on a wavetable entry referring to expanded cycles
+static inline uint8_t get_expanded_wavetable_sample( const uint8_t *cycles, const struct wavetable_entry *e, uint16_t phase2b )
+{
+	uint8_t sample_l = get_cycle_sample_by_phase( get_cycle_pointer( cycles, e->wave_l ), phase2b );
+	uint8_t sample_r = get_cycle_sample_by_phase( get_cycle_pointer( cycles, e->wave_r ), phase2b );
+	return crossfade( sample_l, sample_r, e->factor );
+}
+
+// ---------------------------------------------
+
+/**
+	Slot cache
+
+	For a fixed slot position the crossfaded waveform doesn't change, so it can be computed
+	once into a 128-sample cycle and then played with a single lookup per sample (see
+	get_cycle_sample_by_phase()). Cycles are created lazily, when a position is first used,
+	replacing the least recently used one. The cached samples are exactly the same as
+	the ones returned by get_wavetable_sample() for the entry from get_slot_entry().
+
+	The cache is bound to a wavetable with slot_cache_init(), which has to be called
+	again whenever the wavetable (or its contents) changes.
+*/
+
+//! Number of slot positions held by a slot cache (DEFAULT_WAVETABLE_SIZE never causes a replacement
+//! as long as only integer slots are played)
+#ifndef SLOT_CACHE_SIZE
+#define SLOT_CACHE_SIZE 2
+#endif
+
+//! Marks unused slot cache lines
+#define SLOT_CACHE_EMPTY 0xffff
+
+//! Cache of crossfaded slot cycles
+struct slot_cache
+{
+	const struct wavetable_entry *wavetable;
+	const uint8_t *waveforms;
+	uint8_t expanded;
+	uint16_t position[SLOT_CACHE_SIZE];
+	uint16_t used[SLOT_CACHE_SIZE];
+	uint16_t clock;
+	uint8_t cycle[SLOT_CACHE_SIZE][WAVEFORM_CYCLE_SIZE];
+};
+
+// ---------------------------------------------
+
+// Some DSP type aliases
+typedef int8_t audio_signal;
+typedef int16_t integrator;
+typedef integrator filter1pole;
+
+//! Safe int16_t add (no overflow and underflow)
+static inline int16_t safe_add( int16_t a, int16_t b )
+{
+	if ( a > 0 && b > INT16_MAX - a )
+		return INT16_MAX;
+	else if ( a < 0 && b < INT16_MIN - a )
+		return INT16_MIN;
+	return a + b;
+}
+
+//! A 16-bit overflow/underflow-safe digital integrator
+static inline integrator integrator_feed( integrator *i, integrator x )
+{
+	return *i = safe_add( *i, x );
+	// return *i += x;
+}
+
+//! A 1 pole filter based on the above integrator
+//! \see integrator
+static inline audio_signal filter1pole_feed( filter1pole *f, int8_t k, audio_signal x )
+{
+	integrator_feed( f, ( x - ( *f / 256 ) ) * k );
+	return *f / 256;
+}
+
+// ---------------------------------------------
+
+//! Wavetable index - offsets of all wavetables in the wavetable data
+struct wavetable_index
+{
+	const uint8_t *data;
+	uint8_t count;
+	uint16_t offset[WAVETABLE_INDEX_SIZE];
+};
+
+//! Returns a pointer to the n-th wavetable (or NULL if there's no such wavetable)
+static inline const uint8_t *wavetable_index_get( const struct wavetable_index *index, uint8_t n )
+{
+	if ( n >= index->count ) return NULL;
+	return index->data + index->offset[n];
+}
+
+extern void expand_waveform( uint8_t *cycle, const uint8_t *ptr );
+extern void waveform_cache_init( struct waveform_cache *cache );
+extern uint8_t waveform_cache_find( struct waveform_cache *cache, const uint8_t *source, uint8_t *found, uint8_t *miss );
+extern uint8_t waveform_cache_get( struct waveform_cache *cache, const uint8_t *ptr, uint8_t *miss );
+extern uint8_t expand_wavetable( struct wavetable_entry *dest, const struct wavetable_entry *src, uint8_t wavetable_size, const uint8_t *waveforms, struct waveform_cache *cache );
+extern void slot_cache_init( struct slot_cache *cache, const struct wavetable_entry *wavetable, const uint8_t *waveforms, uint8_t expanded );
+extern const uint8_t *slot_cache_get( struct slot_cache *cache, uint16_t position );
+
+extern const uint8_t *load_wavetable( struct wavetable_entry *entries, uint8_t wavetable_size, const uint8_t *data );
+extern const uint8_t *skip_wavetable( uint8_t wavetable_size, const uint8_t *data, const uint8_t *end );
+extern uint8_t wavetable_index_scan( struct wavetable_index *index, uint8_t wavetable_size, const uint8_t *data, uint16_t size );
+
+#endif
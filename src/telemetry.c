@@ -0,0 +1,64 @@
+#include <avr/interrupt.h>
+#include <inttypes.h>
+#include "telemetry.h"
+#include "synth.h"
+#include "com.h"
+
+//! Frame being sent
+static uint8_t frame[TELEMETRY_FRAME_SIZE];
+static uint8_t frame_pos = TELEMETRY_FRAME_SIZE;
+
+//! Windows count of the last frame
+static uint16_t frame_windows = 0;
+
+//! Appends a 16-bit value as three 7-bit bytes
+static uint8_t *telemetry_put( uint8_t *ptr, uint16_t value )
+{
+	*ptr++ = value & 0x7f;
+	*ptr++ = ( value >> 7 ) & 0x7f;
+	*ptr++ = value >> 14;
+	return ptr;
+}
+
+//! Builds a frame from the current load meter statistics
+static void telemetry_frame( )
+{
+	// The underrun counter is updated by the ISR
+	uint8_t sreg = SREG;
+	cli( );
+	uint16_t underruns = synth_underruns;
+	SREG = sreg;
+
+	uint8_t *ptr = frame;
+	*ptr++ = 0xf0;
+	*ptr++ = TELEMETRY_SYSEX_ID;
+	*ptr++ = TELEMETRY_FRAME_LOAD;
+	*ptr++ = synth_load_stats.windows & 0x7f;
+	ptr = telemetry_put( ptr, synth_load_stats.isr_min );
+	ptr = telemetry_put( ptr, synth_load_stats.isr_avg );
+	ptr = telemetry_put( ptr, synth_load_stats.isr_max );
+	ptr = telemetry_put( ptr, synth_load_stats.idle_avg );
+	ptr = telemetry_put( ptr, synth_render_stats.max_block_cycles );
+	ptr = telemetry_put( ptr, underruns );
+	*ptr = 0xf7;
+	frame_pos = 0;
+}
+
+/**
+	Sends the load meter statistics - has to be called from the main loop.
+	Never waits for the UART - a byte is only sent when the transmitter is ready,
+	so a frame takes many calls.
+*/
+void telemetry_update( )
+{
+	if ( frame_pos == TELEMETRY_FRAME_SIZE )
+	{
+		// Nothing new to send
+		if ( synth_load_stats.windows == frame_windows ) return;
+		frame_windows = synth_load_stats.windows;
+		telemetry_frame( );
+	}
+
+	if ( comtxready( ) )
+		comtx( frame[frame_pos++] );
+}
@@ -0,0 +1,28 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+#include <inttypes.h>
+
+/**
+	\file telemetry.h
+	\brief Load meter telemetry over the UART (MIDI out)
+
+	Every time synth_load_stats is updated, a SysEx frame with the non-commercial
+	manufacturer ID is sent. It's ignored by anything listening to the MIDI output.
+
+	F0 7D 01 <sequence> <isr_min> <isr_avg> <isr_max> <idle_avg> <max_block_cycles> <underruns> F7
+
+	Each 16-bit value is sent as three 7-bit bytes, the least significant first. The
+	sequence number is the low 7 bits of synth_load_stats.windows. A frame is 23 bytes
+	(7.4 ms at 31250 baud) and one is sent every SYNTH_LOAD_WINDOW samples (256 ms).
+*/
+
+#define TELEMETRY_SYSEX_ID 0x7d
+#define TELEMETRY_FRAME_LOAD 0x01
+
+//! Number of 16-bit values in a frame
+#define TELEMETRY_VALUES 6
+#define TELEMETRY_FRAME_SIZE ( 5 + 3 * TELEMETRY_VALUES )
+
+extern void telemetry_update( );
+
+#endif
@@ -0,0 +1,211 @@
+#include <string.h>
+#include "voice.h"
+
+//! Default envelope rates (envelope level change per control rate tick)
+#define VOICE_DEFAULT_ATTACK 4096
+#define VOICE_DEFAULT_RELEASE 1024
+
+//! Resets all voices
+void voice_bank_init( struct voice_bank *bank )
+{
+	memset( bank, 0, sizeof( *bank ) );
+	bank->k = 64;
+	bank->attack = VOICE_DEFAULT_ATTACK;
+	bank->release = VOICE_DEFAULT_RELEASE;
+	bank->render_mix = voice_render_mix;
+}
+
+//! Picks a voice for a new note - the same note, a free voice, the quietest released one or the oldest one
+static voice_id voice_allocate( struct voice_bank *bank, uint8_t note )
+{
+	voice_id free = VOICE_COUNT, released = VOICE_COUNT, oldest = 0;
+	uint16_t released_env = UINT16_MAX, oldest_age = 0;
+
+	for ( voice_id v = 0; v < VOICE_COUNT; v++ )
+	{
+		uint8_t stage = bank->stage[v];
+
+		if ( stage == VOICE_OFF )
+		{
+			if ( free == VOICE_COUNT ) free = v;
+			continue;
+		}
+
+		// Retrigger voice already playing this note
+		if ( bank->note[v] == note ) return v;
+
+		if ( stage == VOICE_RELEASE && bank->env[v] < released_env )
+		{
+			released = v;
+			released_env = bank->env[v];
+		}
+
+		uint16_t age = bank->clock - bank->start[v];
+		if ( age >= oldest_age )
+		{
+			oldest = v;
+			oldest_age = age;
+		}
+	}
+
+	if ( free != VOICE_COUNT ) return free;
+	return released != VOICE_COUNT ? released : oldest;
+}
+
+/**
+	Starts a note, stealing a voice if necessary
+	\param step is the DDS phase step (see voice_pitch_step())
+	\param slot is the initial wavetable slot position (see SLOT_POSITION())
+	\returns the voice used
+*/
+voice_id voice_note_on( struct voice_bank *bank, uint8_t note, uint8_t velocity, voice_phase step, uint16_t slot )
+{
+	voice_id v = voice_allocate( bank, note );
+
+	bank->phase[v] = 0;
+	bank->step[v] = step;
+	bank->slot[v] = slot;
+	bank->fa[v] = 0;
+	bank->fb[v] = 0;
+	bank->env[v] = 0;
+	bank->stage[v] = VOICE_ATTACK;
+	bank->gain[v] = 0;
+	bank->note[v] = note;
+	bank->velocity[v] = velocity;
+	bank->start[v] = bank->clock++;
+	return v;
+}
+
+//! Releases all voices playing a note
+void voice_note_off( struct voice_bank *bank, uint8_t note )
+{
+	for ( voice_id v = 0; v < VOICE_COUNT; v++ )
+		if ( bank->note[v] == note && ( bank->stage[v] == VOICE_ATTACK || bank->stage[v] == VOICE_SUSTAIN ) )
+			bank->stage[v] = VOICE_RELEASE;
+}
+
+//! Updates envelopes and voice gains - should be called at control rate
+void voice_control( struct voice_bank *bank )
+{
+	for ( voice_id v = 0; v < VOICE_COUNT; v++ )
+	{
+		uint16_t env = bank->env[v];
+
+		switch ( bank->stage[v] )
+		{
+			case VOICE_ATTACK:
+				if ( env > UINT16_MAX - bank->attack )
+				{
+					env = UINT16_MAX;
+					bank->stage[v] = VOICE_SUSTAIN;
+				}
+				else
+					env += bank->attack;
+				break;
+
+			case VOICE_RELEASE:
+				if ( env <= bank->release )
+				{
+					env = 0;
+					bank->stage[v] = VOICE_OFF;
+				}
+				else
+					env -= bank->release;
+				break;
+
+			default:
+				break;
+		}
+
+		bank->env[v] = env;
+		bank->gain[v] = ( ( env >> 8 ) * ( ( bank->velocity[v] << 1 ) | 1 ) ) >> 8;
+	}
+}
+
+//! Voice sample sources (see voice_render_one())
+enum voice_source
+{
+	VOICE_SOURCE_WAVEFORMS,
+	VOICE_SOURCE_EXPANDED,
+	VOICE_SOURCE_SLOT_CACHE,
+};
+
+//! Renders n samples of a single voice and adds them to the mix buffer
+//! Slot cache cycles are already crossfaded, so only ptr_l is read in that case
+static inline void voice_render_one( struct voice_bank *bank, voice_id v, const uint8_t *ptr_l, const uint8_t *ptr_r, uint8_t factor, voice_mix *mix, uint8_t n, uint8_t source )
+{
+	// Voice state is kept in local variables for the whole block
+	int8_t k = bank->k;
+	voice_phase phase = bank->phase[v], step = bank->step[v];
+	filter1pole fa = bank->fa[v], fb = bank->fb[v];
+	uint8_t gain = bank->gain[v];
+
+	for ( uint8_t i = 0; i < n; i++ )
+	{
+		uint8_t sample;
+		if ( source == VOICE_SOURCE_SLOT_CACHE )
+			sample = get_cycle_sample_by_phase( ptr_l, VOICE_PHASE_TOP( phase ) );
+		else if ( source == VOICE_SOURCE_EXPANDED )
+			sample = crossfade( get_cycle_sample_by_phase( ptr_l, VOICE_PHASE_TOP( phase ) ), get_cycle_sample_by_phase( ptr_r, VOICE_PHASE_TOP( phase ) ), factor );
+		else
+			sample = crossfade( get_waveform_sample_by_phase( ptr_l, VOICE_PHASE_TOP( phase ) ), get_waveform_sample_by_phase( ptr_r, VOICE_PHASE_TOP( phase ) ), factor );
+
+		audio_signal x = sample - 127;
+		audio_signal y = filter1pole_feed( &fb, k, filter1pole_feed( &fa, k, x ) );
+		mix[i] += ( y * gain ) >> 8;
+		phase += step;
+	}
+
+	bank->phase[v] = phase;
+	bank->fa[v] = fa;
+	bank->fb[v] = fb;
+}
+
+//! Renders n (at most VOICE_BLOCK_SIZE) samples of all active voices and adds them to the mix buffer
+//! Waveform pointers are resolved once per voice and block
+void voice_render_mix( struct voice_bank *bank, const struct wavetable_entry *wavetable, voice_mix *mix, uint8_t n )
+{
+	for ( voice_id v = 0; v < VOICE_COUNT; v++ )
+	{
+		if ( bank->stage[v] == VOICE_OFF ) continue;
+
+		if ( bank->slot_cache != NULL )
+		{
+			voice_render_one( bank, v, slot_cache_get( bank->slot_cache, bank->slot[v] ), NULL, 0, mix, n, VOICE_SOURCE_SLOT_CACHE );
+			continue;
+		}
+
+		struct wavetable_entry e;
+		get_slot_entry( &e, wavetable, bank->slot[v] );
+		if ( bank->expanded )
+			voice_render_one( bank, v, get_cycle_pointer( bank->waveforms, e.wave_l ), get_cycle_pointer( bank->waveforms, e.wave_r ), e.factor, mix, n, VOICE_SOURCE_EXPANDED );
+		else
+			voice_render_one( bank, v, get_waveform_pointer( bank->waveforms, e.wave_l ), get_waveform_pointer( bank->waveforms, e.wave_r ), e.factor, mix, n, VOICE_SOURCE_WAVEFORMS );
+	}
+}
+
+//! Renders n samples of all voices into an 8-bit unsigned output buffer
+void voice_render( struct voice_bank *bank, const struct wavetable_entry *wavetable, uint8_t *out, uint16_t n )
+{
+	voice_mix mix[VOICE_BLOCK_SIZE];
+
+	while ( n )
+	{
+		uint8_t len = n < VOICE_BLOCK_SIZE ? n : VOICE_BLOCK_SIZE;
+
+		memset( mix, 0, sizeof( mix ) );
+		bank->render_mix( bank, wavetable, mix, len );
+
+		// Scaling and clipping
+		for ( uint8_t i = 0; i < len; i++ )
+		{
+			voice_mix y = mix[i] >> VOICE_MIX_SHIFT;
+			if ( y > 127 ) y = 127;
+			else if ( y < -127 ) y = -127;
+			out[i] = 127 + y;
+		}
+
+		out += len;
+		n -= len;
+	}
+}
@@ -0,0 +1,135 @@
+#ifndef VOICE_H
+#define VOICE_H
+#include <inttypes.h>
+#include "synth_core.h"
+#include "pitch.h"
+
+/**
+	\file voice.h
+	\brief Polyphonic voice engine
+
+	All voice parameters are stored in parallel arrays (structure of arrays), so the same
+	code handles 2 voices on the AVR and hundreds of them on the host. Voices are rendered
+	one after another into a 16-bit mix buffer, which keeps each voice's state in registers
+	for the whole block.
+*/
+
+//! Number of voices
+#ifndef VOICE_COUNT
+#define VOICE_COUNT 2
+#endif
+
+//! The mix is divided by 2^VOICE_MIX_SHIFT before output
+#ifndef VOICE_MIX_SHIFT
+#define VOICE_MIX_SHIFT 1
+#endif
+
+//! Maximum number of samples rendered at once (up to 255, voice_render() splits longer requests)
+#ifndef VOICE_BLOCK_SIZE
+#define VOICE_BLOCK_SIZE 16
+#endif
+
+//! Voice index and mix types wide enough for VOICE_COUNT voices
+#if VOICE_COUNT > 255
+typedef uint16_t voice_id;
+#else
+typedef uint8_t voice_id;
+#endif
+
+#if VOICE_COUNT > 256
+typedef int32_t voice_mix;
+#else
+typedef int16_t voice_mix;
+#endif
+
+/**
+	Define VOICE_PHASE24 for 24-bit DDS phase accumulators - the pitch resolution gets 256 times
+	finer, which matters in the low octaves (see pitch.h). Only the top 16 bits are passed to
+	the waveform readers, which use just the top byte anyway. On the AVR the phase is a 3-byte
+	__uint24, so advancing it costs a single extra add-with-carry. On the host the bits above
+	24 are never read, so they're left to overflow.
+*/
+#ifdef VOICE_PHASE24
+#ifdef __AVR__
+typedef __uint24 voice_phase;
+#else
+typedef uint32_t voice_phase;
+#endif
+#define VOICE_PHASE_TOP( phase ) ( (uint16_t)( ( phase ) >> 8 ) )
+#else
+typedef uint16_t voice_phase;
+#define VOICE_PHASE_TOP( phase ) ( phase )
+#endif
+
+//! Returns DDS phase step of a pitch for the voice phase width
+static inline voice_phase voice_pitch_step( uint16_t pitch, uint16_t base )
+{
+#ifdef VOICE_PHASE24
+	return pitch_step24( pitch, base );
+#else
+	return pitch_step( pitch, base );
+#endif
+}
+
+//! Voice envelope stages
+enum voice_stage
+{
+	VOICE_OFF = 0,
+	VOICE_ATTACK,
+	VOICE_SUSTAIN,
+	VOICE_RELEASE,
+};
+
+struct voice_bank;
+
+//! Voice mixing kernel - renders n samples of all active voices and adds them to the mix buffer
+typedef void ( *voice_kernel )( struct voice_bank *bank, const struct wavetable_entry *wavetable, voice_mix *mix, uint8_t n );
+
+//! Voice bank - parameters of all voices
+struct voice_bank
+{
+	// Oscillators
+	voice_phase phase[VOICE_COUNT];
+	voice_phase step[VOICE_COUNT];
+	uint16_t slot[VOICE_COUNT]; // 8.8 fixed-point slot positions (see get_slot_entry())
+
+	// Filters
+	filter1pole fa[VOICE_COUNT];
+	filter1pole fb[VOICE_COUNT];
+
+	// Envelopes and output gain (updated at control rate)
+	uint16_t env[VOICE_COUNT];
+	uint8_t stage[VOICE_COUNT];
+	uint8_t gain[VOICE_COUNT];
+
+	// Voice allocation
+	uint8_t note[VOICE_COUNT];
+	uint8_t velocity[VOICE_COUNT];
+	uint16_t start[VOICE_COUNT];
+	uint16_t clock;
+
+	// Parameters shared by all voices
+	int8_t k;
+	uint16_t attack;
+	uint16_t release;
+
+	// Waveform data the wavetable refers to - 64-byte half-waves or 128-byte cycles
+	// if the wavetable is expanded (see expand_wavetable())
+	const uint8_t *waveforms;
+	uint8_t expanded;
+
+	// Optional slot cache (NULL if not used) - if set, it's read instead of the wavetable
+	struct slot_cache *slot_cache;
+
+	// Kernel used by voice_render() - voice_render_mix() unless replaced with an optimized one
+	voice_kernel render_mix;
+};
+
+extern void voice_bank_init( struct voice_bank *bank );
+extern voice_id voice_note_on( struct voice_bank *bank, uint8_t note, uint8_t velocity, voice_phase step, uint16_t slot );
+extern void voice_note_off( struct voice_bank *bank, uint8_t note );
+extern void voice_control( struct voice_bank *bank );
+extern void voice_render_mix( struct voice_bank *bank, const struct wavetable_entry *wavetable, voice_mix *mix, uint8_t n );
+extern void voice_render( struct voice_bank *bank, const struct wavetable_entry *wavetable, uint8_t *out, uint16_t n );
+
+#endif
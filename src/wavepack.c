@@ -0,0 +1,95 @@
+#include <inttypes.h>
+#include "wavepack.h"
+
+//! Bit stream reader (LSB first) for the packed samples in flash
+struct wavepack_reader
+{
+	const uint8_t *ptr;
+	uint16_t acc;
+	uint8_t bits;
+};
+
+//! Reads an unsigned value of width bits (up to 8)
+static inline uint8_t wavepack_read( struct wavepack_reader *r, uint8_t width )
+{
+	if ( r->bits < width )
+	{
+		r->acc |= (uint16_t) rom_read_byte( r->ptr++ ) << r->bits;
+		r->bits += 8;
+	}
+
+	uint8_t value = r->acc & ( ( 1u << width ) - 1 );
+	r->acc >>= width;
+	r->bits -= width;
+	return value;
+}
+
+/**
+	Decodes a waveform record into a full 128-sample cycle (mirrored like expand_waveform())
+	\param cycle has to have space for WAVEFORM_CYCLE_SIZE samples
+*/
+void wavepack_expand( uint8_t *cycle, const uint8_t *record )
+{
+	struct wavepack_reader r = {.ptr = record + 1};
+	uint8_t encoding = rom_read_byte( record );
+	uint8_t width = 8, sample = 0;
+
+	switch ( encoding )
+	{
+		case WAVEPACK_DELTA4:
+		case WAVEPACK_QUANT4:
+			width = 4;
+			break;
+
+		case WAVEPACK_DELTA6:
+		case WAVEPACK_QUANT6:
+			width = 6;
+			break;
+	}
+
+	for ( uint8_t i = 0; i < WAVEPACK_WAVE_SIZE; i++ )
+	{
+		switch ( encoding )
+		{
+			case WAVEPACK_DELTA4:
+			case WAVEPACK_DELTA6:
+				// The first sample is stored as it is, the differences are sign-extended
+				if ( i == 0 )
+					sample = wavepack_read( &r, 8 );
+				else
+				{
+					uint8_t d = wavepack_read( &r, width );
+					if ( d & ( 1 << ( width - 1 ) ) ) d |= 0xff << width;
+					sample += d;
+				}
+				break;
+
+			case WAVEPACK_QUANT4:
+			case WAVEPACK_QUANT6:
+				// Reconstructed in the middle of the quantization step
+				sample = ( wavepack_read( &r, width ) << ( 8 - width ) ) | ( 1 << ( 7 - width ) );
+				break;
+
+			default:
+				sample = wavepack_read( &r, 8 );
+				break;
+		}
+
+		// The second half is stored, the first one is mirrored
+		cycle[64 + i] = sample;
+		cycle[63 - i] = 255u - sample;
+	}
+}
+
+/**
+	Returns index of the expanded cycle of a packed waveform in the cache - decodes it
+	if it's not there yet (see waveform_cache_get())
+	\param miss is set to 1 if a cycle had to be replaced (can be NULL)
+*/
+uint8_t wavepack_cache_get( struct waveform_cache *cache, const uint8_t *record, uint8_t *miss )
+{
+	uint8_t found;
+	uint8_t line = waveform_cache_find( cache, record, &found, miss );
+	if ( !found ) wavepack_expand( cache->cycle[line], record );
+	return line;
+}
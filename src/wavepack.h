@@ -0,0 +1,47 @@
+#ifndef WAVEPACK_H
+#define WAVEPACK_H
+#include <inttypes.h>
+#include "rom.h"
+#include "synth_core.h"
+
+/**
+	\file wavepack.h
+	\brief Compressed waveform store
+
+	Waveforms (64-byte half-waves) can be stored in flash in a compressed form generated
+	at build time by tools/ppgdata (-z). Every waveform has an entry in an index of 16-bit
+	offsets into the record data, so identical waveforms share one record.
+
+	A record starts with the encoding (enum wavepack_encoding) followed by the payload:
+	 - WAVEPACK_RAW - 64 samples
+	 - WAVEPACK_DELTA4, WAVEPACK_DELTA6 - the first sample and 63 signed 4/6-bit differences
+	 - WAVEPACK_QUANT4, WAVEPACK_QUANT6 - 64 samples reduced to 4/6 most significant bits
+
+	Values narrower than a byte are packed LSB first. Lossy encodings are only chosen by
+	the packer if the reconstruction error doesn't exceed the given bound.
+*/
+
+//! Waveform record encodings
+enum wavepack_encoding
+{
+	WAVEPACK_RAW = 0,
+	WAVEPACK_DELTA4,
+	WAVEPACK_DELTA6,
+	WAVEPACK_QUANT4,
+	WAVEPACK_QUANT6,
+	WAVEPACK_ENCODINGS,
+};
+
+//! Number of samples in a packed waveform
+#define WAVEPACK_WAVE_SIZE 64
+
+//! Returns a pointer to the record of n-th waveform
+static inline const uint8_t *wavepack_record( const uint16_t *index, const uint8_t *records, uint8_t n )
+{
+	return records + rom_read_word( index + n );
+}
+
+extern void wavepack_expand( uint8_t *cycle, const uint8_t *record );
+extern uint8_t wavepack_cache_get( struct waveform_cache *cache, const uint8_t *record, uint8_t *miss );
+
+#endif
@@ -0,0 +1,195 @@
+#!/bin/sh
+#
+#	Bit-exact golden output regression harness (make golden, make golden-approve)
+#
+#	Renders fixed-length deterministic scenarios with the reference paths and compares the
+#	outputs with the approved ones in golden/. The same scenarios are then rendered by every
+#	optimized path and compared with the reference:
+#	 - aplay, every wavetable - the single oscillator (slot and filter LFO sweeps) and the
+#	   voice engine. Reading mirrored half-waves (with the scalar voice kernel) is the reference
+#	   for the other kernels and waveform sources and for bank files (raw and pre-expanded
+#	   waveforms).
+#	   The voice engine is also rendered by a build with APLAY_WIDE_VOICES voices.
+#	 - firmware simulator, golden/*.trace (slot sweeps, filter sweeps, MIDI scripts) - the
+#	   default build is the reference for SYNTH_EXPANDED_WAVES, SYNTH_SLOT_CACHE and
+#	   LOAD_METER builds. PACKED_WAVES and PHASE24 builds sound different, so they are
+#	   compared with goldens of their own.
+#	Every mismatch is reported with the first differing sample.
+#
+#	Usage: tools/golden.sh [-a]
+#	-a approves the current reference outputs as the new goldens (optimized paths are
+#	still checked against them)
+#
+
+APPROVE=0
+[ "$1" = "-a" ] && APPROVE=1
+
+cd "$(dirname "$0")/.." || exit 1
+HOSTCC=${HOSTCC:-cc}
+GOLDEN=golden
+OUT=bin/golden
+APLAY=$OUT/aplay
+APLAY_WIDE=$OUT/aplay-wide
+
+# Scenario settings
+APLAY_SAMPLES=8192
+APLAY_NOTES=36,43,48,55,60,64,67,70,72,74
+APLAY_WIDE_VOICES=250
+SIM_DURATION=1000
+
+CHECKED=0
+FAILED=0
+APPROVED=0
+
+# Reports the first differing sample of two outputs
+# diff_report <name> <output> <expected> <expected path description>
+diff_report( )
+{
+	FAILED=$((FAILED + 1))
+	first=$(cmp -l "$2" "$3" 2>/dev/null | head -n 1)
+	if [ -n "$first" ]; then
+		set -- "$1" "$2" "$3" "$4" $first
+		printf "%s: sample %d is %d, %s has %d\n" "$1" $(($5 - 1)) "0$6" "$4" "0$7"
+	else
+		printf "%s: %d samples, %s has %d\n" "$1" "$(wc -c < "$2")" "$4" "$(wc -c < "$3")"
+	fi
+}
+
+# Compares a reference output with its golden (or approves it)
+# check_golden <name> <output>
+check_golden( )
+{
+	CHECKED=$((CHECKED + 1))
+	golden=$GOLDEN/$1.raw
+	if cmp -s "$2" "$golden"; then
+		return
+	elif [ $APPROVE = 1 ]; then
+		cp "$2" "$golden"
+		APPROVED=$((APPROVED + 1))
+		echo "$1: approved"
+	elif [ ! -f "$golden" ]; then
+		FAILED=$((FAILED + 1))
+		echo "$1: no golden output (make golden-approve)"
+	else
+		diff_report "$1" "$2" "$golden" "the golden"
+	fi
+}
+
+# Compares an optimized path output with the reference
+# check_reference <name> <output> <reference output> <reference description>
+check_reference( )
+{
+	CHECKED=$((CHECKED + 1))
+	cmp -s "$2" "$3" || diff_report "$1" "$2" "$3" "$4"
+}
+
+# ---------------------------------------------
+
+mkdir -p $OUT $GOLDEN
+
+# Builds with make - the output goes to the build log, which is shown if the build fails
+# build <make arguments>
+build( )
+{
+	make -s "$@" >> $OUT/build.log 2>&1 && return
+	cat $OUT/build.log
+	exit 1
+}
+
+echo "golden: building"
+: > $OUT/build.log
+build -C aplay CC="$HOSTCC" APLAY="../$APLAY"
+build -C aplay CC="$HOSTCC" VOICES=$APLAY_WIDE_VOICES APLAY="../$APLAY_WIDE"
+build bank && mv bin/evu10.ppgbank $OUT/raw.ppgbank
+build bank APLAY_DATA_FLAGS=-x && mv bin/evu10.ppgbank $OUT/expanded.ppgbank
+
+# Firmware simulator builds - name and make arguments
+SIM_BUILDS="default:
+expanded:CFLAGS=-DSYNTH_EXPANDED_WAVES
+slot-cache:CFLAGS=-DSYNTH_SLOT_CACHE
+load-meter:LOAD_METER=1
+packed:PACKED_WAVES=1
+phase24:PHASE24=1"
+
+echo "$SIM_BUILDS" | while IFS=: read -r name args; do
+	build -B bin/sim $args && mv bin/sim $OUT/sim-$name
+done || exit 1
+
+# Voice kernels supported by this CPU
+KERNELS=scalar
+for k in sse2 avx2; do
+	VOICE_KERNEL=$k $APLAY 1 0 60 > /dev/null 2>&1 && KERNELS="$KERNELS $k"
+done
+echo "golden: voice kernels: $KERNELS"
+
+# ---------------------------------------------
+
+echo "golden: aplay"
+wavetable=0
+while [ $wavetable -lt 29 ]; do
+	# The single oscillator - the reference and every waveform source
+	name=aplay-mono-$wavetable
+	ref=$OUT/$name.raw
+	VOICE_SOURCE=half-waves $APLAY $APLAY_SAMPLES $wavetable > $ref
+	check_golden $name $ref
+
+	for source in expanded slot-cache; do
+		VOICE_SOURCE=$source $APLAY $APLAY_SAMPLES $wavetable > $OUT/out.raw
+		check_reference "$name ($source)" $OUT/out.raw $ref "the half-wave path"
+	done
+
+	for bank in raw expanded; do
+		PPG_BANK=$OUT/$bank.ppgbank $APLAY $APLAY_SAMPLES $wavetable > $OUT/out.raw
+		check_reference "$name ($bank bank)" $OUT/out.raw $ref "the half-wave path"
+	done
+
+	# The voice engine - the reference and every kernel and waveform source
+	name=aplay-poly-$wavetable
+	ref=$OUT/$name.raw
+	VOICE_KERNEL=scalar VOICE_SOURCE=half-waves $APLAY $APLAY_SAMPLES $wavetable $APLAY_NOTES > $ref
+	check_golden $name $ref
+
+	for kernel in $KERNELS; do
+		for source in half-waves expanded slot-cache; do
+			VOICE_KERNEL=$kernel VOICE_SOURCE=$source $APLAY $APLAY_SAMPLES $wavetable $APLAY_NOTES > $OUT/out.raw
+			check_reference "$name ($kernel, $source)" $OUT/out.raw $ref "the scalar half-wave path"
+		done
+	done
+
+	# An odd voice count over 240 - the SIMD kernels' last lane group is partial and
+	# v0 + lanes doesn't fit in an 8-bit voice_id (the unused voices don't change the mix)
+	for kernel in $KERNELS; do
+		for source in half-waves expanded slot-cache; do
+			VOICE_KERNEL=$kernel VOICE_SOURCE=$source $APLAY_WIDE $APLAY_SAMPLES $wavetable $APLAY_NOTES > $OUT/out.raw
+			check_reference "$name ($APLAY_WIDE_VOICES voices, $kernel, $source)" $OUT/out.raw $ref "the scalar half-wave path"
+		done
+	done
+
+	for bank in raw expanded; do
+		PPG_BANK=$OUT/$bank.ppgbank $APLAY $APLAY_SAMPLES $wavetable $APLAY_NOTES > $OUT/out.raw
+		check_reference "$name ($bank bank)" $OUT/out.raw $ref "the scalar half-wave path"
+	done
+
+	wavetable=$((wavetable + 1))
+done
+
+echo "golden: firmware simulator"
+for trace in $GOLDEN/*.trace; do
+	scenario=$(basename "$trace" .trace)
+	ref=$OUT/sim-$scenario.raw
+	$OUT/sim-default -i "$trace" -t $SIM_DURATION -o $ref 2> /dev/null || exit 1
+	check_golden sim-$scenario $ref
+
+	for variant in expanded slot-cache load-meter; do
+		$OUT/sim-$variant -i "$trace" -t $SIM_DURATION -o $OUT/out.raw 2> /dev/null || exit 1
+		check_reference "sim-$scenario ($variant)" $OUT/out.raw $ref "the default build"
+	done
+
+	for variant in packed phase24; do
+		$OUT/sim-$variant -i "$trace" -t $SIM_DURATION -o $OUT/sim-$scenario-$variant.raw 2> /dev/null || exit 1
+		check_golden sim-$scenario-$variant $OUT/sim-$scenario-$variant.raw
+	done
+done
+
+echo "golden: $CHECKED outputs checked, $FAILED mismatches, $APPROVED approved"
+[ $FAILED = 0 ]
@@ -0,0 +1,540 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+/**
+	\file isrcycles.c
+	\brief Static worst-case cycle count of an interrupt handler
+
+	Reads avr-objdump -d output, splits the function into basic blocks and finds the
+	longest path through them. Cycle counts come from the AVR instruction set manual for
+	the AVRe core (ATmega32) - a taken branch or a skip over a two-word instruction costs
+	the extra cycles, called functions are analyzed the same way and their worst case is
+	added to the call. Prologue and epilogue are ordinary instructions, so the register
+	saves are counted too. The interrupt response and the jump from the vector table
+	(7 cycles by default) are added on top.
+
+	Loops and indirect jumps or calls can't be bounded, so they are reported as errors.
+	Conservative counts are used where the manual differs between devices.
+
+	Prints every block of the function (the worst path marked with '*') and exits with 1
+	if the worst case exceeds the budget.
+
+	Usage: avr-objdump -d synth.elf | isrcycles -f symbol [-b budget] [-e entry cycles] [file]
+*/
+
+//! Instruction kinds - how the control flow continues
+enum avr_kind
+{
+	AVR_NORMAL = 0,
+	AVR_BRANCH,   //!< Conditional relative branch (1 cycle, 2 if taken)
+	AVR_JUMP,     //!< Unconditional jump
+	AVR_CALL,     //!< Direct call
+	AVR_SKIP,     //!< Skips the next instruction if the condition is met
+	AVR_RETURN,   //!< ret/reti
+	AVR_INDIRECT, //!< ijmp/icall - can't be followed
+};
+
+//! Instruction timing
+struct avr_timing
+{
+	const char *mnemonic;
+	uint8_t cycles;
+	uint8_t kind;
+};
+
+//! AVRe instruction timing (the not taken / not skipped case)
+static const struct avr_timing avr_timings[] =
+{
+	// Arithmetic and logic
+	{"add", 1, AVR_NORMAL}, {"adc", 1, AVR_NORMAL}, {"adiw", 2, AVR_NORMAL},
+	{"sub", 1, AVR_NORMAL}, {"subi", 1, AVR_NORMAL}, {"sbc", 1, AVR_NORMAL},
+	{"sbci", 1, AVR_NORMAL}, {"sbiw", 2, AVR_NORMAL}, {"and", 1, AVR_NORMAL},
+	{"andi", 1, AVR_NORMAL}, {"or", 1, AVR_NORMAL}, {"ori", 1, AVR_NORMAL}, {"eor", 1, AVR_NORMAL},
+	{"com", 1, AVR_NORMAL}, {"neg", 1, AVR_NORMAL}, {"sbr", 1, AVR_NORMAL}, {"cbr", 1, AVR_NORMAL},
+	{"inc", 1, AVR_NORMAL}, {"dec", 1, AVR_NORMAL}, {"tst", 1, AVR_NORMAL}, {"clr", 1, AVR_NORMAL},
+	{"ser", 1, AVR_NORMAL}, {"mul", 2, AVR_NORMAL}, {"muls", 2, AVR_NORMAL},
+	{"mulsu", 2, AVR_NORMAL}, {"fmul", 2, AVR_NORMAL}, {"fmuls", 2, AVR_NORMAL},
+	{"fmulsu", 2, AVR_NORMAL}, {"cp", 1, AVR_NORMAL}, {"cpc", 1, AVR_NORMAL},
+	{"cpi", 1, AVR_NORMAL},
+
+	// Bits
+	{"lsl", 1, AVR_NORMAL}, {"lsr", 1, AVR_NORMAL}, {"rol", 1, AVR_NORMAL}, {"ror", 1, AVR_NORMAL},
+	{"asr", 1, AVR_NORMAL}, {"swap", 1, AVR_NORMAL}, {"bset", 1, AVR_NORMAL},
+	{"bclr", 1, AVR_NORMAL}, {"sbi", 2, AVR_NORMAL}, {"cbi", 2, AVR_NORMAL},
+	{"bst", 1, AVR_NORMAL}, {"bld", 1, AVR_NORMAL}, {"sec", 1, AVR_NORMAL}, {"clc", 1, AVR_NORMAL},
+	{"sen", 1, AVR_NORMAL}, {"cln", 1, AVR_NORMAL}, {"sez", 1, AVR_NORMAL}, {"clz", 1, AVR_NORMAL},
+	{"sei", 1, AVR_NORMAL}, {"cli", 1, AVR_NORMAL}, {"ses", 1, AVR_NORMAL}, {"cls", 1, AVR_NORMAL},
+	{"sev", 1, AVR_NORMAL}, {"clv", 1, AVR_NORMAL}, {"set", 1, AVR_NORMAL}, {"clt", 1, AVR_NORMAL},
+	{"seh", 1, AVR_NORMAL}, {"clh", 1, AVR_NORMAL},
+
+	// Data transfer (ld/st with pre-decrement are handled in avr_timing())
+	{"mov", 1, AVR_NORMAL}, {"movw", 1, AVR_NORMAL}, {"ldi", 1, AVR_NORMAL}, {"ld", 2, AVR_NORMAL},
+	{"ldd", 2, AVR_NORMAL}, {"lds", 2, AVR_NORMAL}, {"st", 2, AVR_NORMAL}, {"std", 2, AVR_NORMAL},
+	{"sts", 2, AVR_NORMAL}, {"lpm", 3, AVR_NORMAL}, {"elpm", 3, AVR_NORMAL}, {"in", 1, AVR_NORMAL},
+	{"out", 1, AVR_NORMAL}, {"push", 2, AVR_NORMAL}, {"pop", 2, AVR_NORMAL},
+
+	// MCU control
+	{"nop", 1, AVR_NORMAL}, {"sleep", 1, AVR_NORMAL}, {"wdr", 1, AVR_NORMAL},
+	{"break", 1, AVR_NORMAL},
+
+	// Control flow
+	{"rjmp", 2, AVR_JUMP}, {"jmp", 3, AVR_JUMP}, {"rcall", 3, AVR_CALL}, {"call", 4, AVR_CALL},
+	{"ret", 4, AVR_RETURN}, {"reti", 4, AVR_RETURN},
+	{"ijmp", 2, AVR_INDIRECT}, {"eijmp", 2, AVR_INDIRECT}, {"icall", 3, AVR_INDIRECT}, {"eicall", 4, AVR_INDIRECT},
+	{"cpse", 1, AVR_SKIP}, {"sbrc", 1, AVR_SKIP}, {"sbrs", 1, AVR_SKIP}, {"sbic", 1, AVR_SKIP}, {"sbis", 1, AVR_SKIP},
+	{"brbs", 1, AVR_BRANCH}, {"brbc", 1, AVR_BRANCH}, {"breq", 1, AVR_BRANCH}, {"brne", 1, AVR_BRANCH},
+	{"brcs", 1, AVR_BRANCH}, {"brcc", 1, AVR_BRANCH}, {"brsh", 1, AVR_BRANCH}, {"brlo", 1, AVR_BRANCH},
+	{"brmi", 1, AVR_BRANCH}, {"brpl", 1, AVR_BRANCH}, {"brge", 1, AVR_BRANCH}, {"brlt", 1, AVR_BRANCH},
+	{"brhs", 1, AVR_BRANCH}, {"brhc", 1, AVR_BRANCH}, {"brts", 1, AVR_BRANCH}, {"brtc", 1, AVR_BRANCH},
+	{"brvs", 1, AVR_BRANCH}, {"brvc", 1, AVR_BRANCH}, {"brie", 1, AVR_BRANCH}, {"brid", 1, AVR_BRANCH},
+};
+
+//! Disassembled instruction
+struct insn
+{
+	uint32_t addr;
+	uint8_t size;
+	uint8_t kind;
+	int cycles;       //!< -1 if unknown
+	uint32_t target;  //!< Branch, jump or call target
+	uint8_t has_target;
+	char text[80];    //!< Mnemonic and operands
+};
+
+//! Basic block
+struct block
+{
+	size_t first, last;      //!< Instruction range
+	unsigned int cycles;     //!< Cycles of the block excluding the last instruction
+	uint8_t succ_count;
+	size_t succ[2];          //!< Successor blocks
+	unsigned int edge[2];    //!< Cycles of the last instruction when continuing to the successor
+	unsigned int exit;       //!< Cycles of the last instruction when leaving the function (if no successors)
+	uint8_t state;           //!< 0 - not visited, 1 - being visited, 2 - done
+	unsigned long worst;     //!< Worst case from the beginning of the block to the return
+	int next;                //!< Successor on the worst path (-1 if none)
+};
+
+//! Function (a symbol and the instructions following it)
+struct function
+{
+	char name[128];
+	size_t first, count;
+	uint8_t state;           //!< 0 - not analyzed, 1 - being analyzed, 2 - done
+	unsigned long worst;
+	struct block *blocks;
+	size_t block_count;
+};
+
+static struct insn *insns;
+static size_t insn_count;
+static struct function *functions;
+static size_t function_count;
+
+//! Reports an error and exits
+static void fail( const struct insn *in, const char *message )
+{
+	if ( in != NULL )
+		fprintf( stderr, "isrcycles: 0x%04" PRIx32 " (%s): %s\n", in->addr, in->text, message );
+	else
+		fprintf( stderr, "isrcycles: %s\n", message );
+	exit( 1 );
+}
+
+//! Appends an element to a dynamic array
+static void *grow( void *array, size_t count, size_t size )
+{
+	if ( count && ( count < 16 || ( count & ( count - 1 ) ) ) ) return array;
+	array = realloc( array, ( count ? count * 2 : 16 ) * size );
+	if ( array == NULL ) fail( NULL, "out of memory" );
+	return array;
+}
+
+// ---------------------------------------------
+
+//! Looks up the timing of an instruction
+static void avr_timing( struct insn *in, const char *mnemonic, const char *operands )
+{
+	in->cycles = -1;
+	for ( size_t i = 0; i < sizeof( avr_timings ) / sizeof( avr_timings[0] ); i++ )
+		if ( !strcmp( mnemonic, avr_timings[i].mnemonic ) )
+		{
+			in->cycles = avr_timings[i].cycles;
+			in->kind = avr_timings[i].kind;
+			break;
+		}
+
+	// Loads and stores with pre-decrement take an extra cycle on some devices
+	if ( ( !strcmp( mnemonic, "ld" ) || !strcmp( mnemonic, "st" ) ) && strchr( operands, '-' ) )
+		in->cycles = 3;
+
+	// Branch targets - relative (.+n) or absolute (0x...)
+	if ( in->kind == AVR_BRANCH || in->kind == AVR_JUMP || in->kind == AVR_CALL )
+	{
+		const char *rel = strstr( operands, ".+" );
+		if ( rel == NULL ) rel = strstr( operands, ".-" );
+
+		if ( rel != NULL )
+		{
+			in->target = in->addr + in->size + strtol( rel + 1, NULL, 0 );
+			in->has_target = 1;
+		}
+		else if ( !strncmp( operands, "0x", 2 ) )
+		{
+			in->target = strtoul( operands, NULL, 16 );
+			in->has_target = 1;
+		}
+	}
+}
+
+//! Reads objdump -d output
+static void read_disassembly( FILE *f )
+{
+	char line[512];
+
+	while ( fgets( line, sizeof( line ), f ) )
+	{
+		unsigned int addr;
+		char name[128];
+		int n = -1;
+
+		// Symbol - 000000a4 <__vector_7>:
+		if ( sscanf( line, "%x <%127[^>]>:", &addr, name ) == 2 )
+		{
+			functions = grow( functions, function_count, sizeof( *functions ) );
+			struct function *fn = &functions[function_count++];
+			memset( fn, 0, sizeof( *fn ) );
+			snprintf( fn->name, sizeof( fn->name ), "%s", name );
+			fn->first = insn_count;
+			continue;
+		}
+
+		// Instruction - a4:	1f 92       	push	r1
+		// n stays -1 unless the colon matches ("Disassembly of section .text:" and the like)
+		if ( sscanf( line, " %x:%n", &addr, &n ) != 1 || n < 0 || function_count == 0 )
+			continue;
+
+		char *ptr = line + n;
+		uint8_t size = 0;
+		while ( isspace( (unsigned char) *ptr ) ) ptr++;
+		while ( isxdigit( (unsigned char) ptr[0] ) && isxdigit( (unsigned char) ptr[1] ) && ( ptr[2] == ' ' || ptr[2] == '\t' ) )
+		{
+			size++;
+			ptr += 3;
+		}
+
+		char mnemonic[16] = "", operands[64] = "";
+		sscanf( ptr, "%15s %63[^;\n]", mnemonic, operands );
+		for ( char *end = operands + strlen( operands ); end > operands && isspace( (unsigned char) end[-1] ); ) *--end = 0;
+
+		// Long instruction split into two lines
+		if ( !mnemonic[0] )
+		{
+			if ( insn_count ) insns[insn_count - 1].size += size;
+			continue;
+		}
+
+		insns = grow( insns, insn_count, sizeof( *insns ) );
+		struct insn *in = &insns[insn_count++];
+		memset( in, 0, sizeof( *in ) );
+		in->addr = addr;
+		in->size = size;
+		snprintf( in->text, sizeof( in->text ), "%s %s", mnemonic, operands );
+		avr_timing( in, mnemonic, operands );
+		functions[function_count - 1].count++;
+	}
+}
+
+//! Finds a function by name
+static struct function *find_function( const char *name )
+{
+	for ( size_t i = 0; i < function_count; i++ )
+		if ( !strcmp( functions[i].name, name ) && functions[i].count )
+			return &functions[i];
+	return NULL;
+}
+
+//! Finds the function starting at an address
+static struct function *function_at( uint32_t addr )
+{
+	for ( size_t i = 0; i < function_count; i++ )
+		if ( functions[i].count && insns[functions[i].first].addr == addr )
+			return &functions[i];
+	return NULL;
+}
+
+//! Finds an instruction of the function at an address (returns count if there's none)
+static size_t insn_at( const struct function *fn, uint32_t addr )
+{
+	for ( size_t i = 0; i < fn->count; i++ )
+		if ( insns[fn->first + i].addr == addr )
+			return i;
+	return fn->count;
+}
+
+// ---------------------------------------------
+
+static unsigned long analyze_function( struct function *fn );
+
+//! Worst case of a call or a tail jump - the called function has to be known
+static unsigned long callee_cycles( const struct insn *in )
+{
+	struct function *callee = in->has_target ? function_at( in->target ) : NULL;
+	if ( callee == NULL ) fail( in, "the target is not a known function" );
+	if ( callee->state == 1 ) fail( in, "recursive call" );
+	return analyze_function( callee );
+}
+
+//! Splits a function into basic blocks
+static void split_blocks( struct function *fn )
+{
+	uint8_t *leader = calloc( fn->count + 2, 1 );
+	size_t *block_of = calloc( fn->count + 2, sizeof( size_t ) );
+	if ( leader == NULL || block_of == NULL ) fail( NULL, "out of memory" );
+
+	// Block leaders - the entry, branch targets and whatever follows a branch
+	leader[0] = 1;
+	for ( size_t i = 0; i < fn->count; i++ )
+	{
+		const struct insn *in = &insns[fn->first + i];
+		if ( in->kind == AVR_BRANCH || in->kind == AVR_JUMP )
+		{
+			size_t t = in->has_target ? insn_at( fn, in->target ) : fn->count;
+			if ( t < fn->count ) leader[t] = 1;
+			else if ( in->kind == AVR_BRANCH ) fail( in, "branch out of the function" );
+		}
+
+		if ( in->kind == AVR_BRANCH || in->kind == AVR_JUMP || in->kind == AVR_RETURN || in->kind == AVR_INDIRECT )
+			leader[i + 1] = 1;
+		if ( in->kind == AVR_SKIP )
+			leader[i + 1] = leader[i + 2] = 1;
+	}
+
+	for ( size_t i = 0; i < fn->count; i++ )
+	{
+		if ( leader[i] )
+		{
+			fn->blocks = grow( fn->blocks, fn->block_count, sizeof( *fn->blocks ) );
+			struct block *b = &fn->blocks[fn->block_count++];
+			memset( b, 0, sizeof( *b ) );
+			b->first = i;
+			b->next = -1;
+		}
+
+		fn->blocks[fn->block_count - 1].last = i;
+		block_of[i] = fn->block_count - 1;
+	}
+
+	// Successors
+	for ( size_t j = 0; j < fn->block_count; j++ )
+	{
+		struct block *b = &fn->blocks[j];
+		const struct insn *last = &insns[fn->first + b->last];
+		size_t next = b->last + 1;
+
+		switch ( last->kind )
+		{
+			case AVR_BRANCH:
+				b->succ[b->succ_count] = block_of[insn_at( fn, last->target )];
+				b->edge[b->succ_count++] = last->cycles + 1;
+				break;
+
+			case AVR_SKIP:
+				if ( next + 1 < fn->count )
+				{
+					b->succ[b->succ_count] = block_of[next + 1];
+					b->edge[b->succ_count++] = last->cycles + ( insns[fn->first + next].size > 2 ? 2 : 1 );
+				}
+				break;
+
+			case AVR_JUMP:
+			{
+				size_t t = last->has_target ? insn_at( fn, last->target ) : fn->count;
+				if ( t < fn->count )
+				{
+					b->succ[b->succ_count] = block_of[t];
+					b->edge[b->succ_count++] = last->cycles;
+				}
+				next = fn->count;
+				break;
+			}
+
+			case AVR_RETURN:
+			case AVR_INDIRECT:
+				next = fn->count;
+				break;
+		}
+
+		// Falls through to the next block
+		if ( next < fn->count )
+		{
+			b->succ[b->succ_count] = block_of[next];
+			b->edge[b->succ_count++] = last->cycles;
+		}
+	}
+
+	free( leader );
+	free( block_of );
+}
+
+//! Worst case from the beginning of a block to the return
+static unsigned long analyze_block( struct function *fn, size_t j )
+{
+	struct block *b = &fn->blocks[j];
+	if ( b->state == 2 ) return b->worst;
+	if ( b->state == 1 ) fail( &insns[fn->first + b->first], "loop - the worst case can't be bounded" );
+	b->state = 1;
+
+	// The block itself (calls include the called function)
+	for ( size_t i = b->first; i <= b->last; i++ )
+	{
+		const struct insn *in = &insns[fn->first + i];
+		if ( in->cycles < 0 ) fail( in, "unknown instruction" );
+		if ( in->kind == AVR_INDIRECT ) fail( in, "indirect jumps and calls can't be followed" );
+		if ( i == b->last ) break;
+		b->cycles += in->cycles;
+		if ( in->kind == AVR_CALL ) b->cycles += callee_cycles( in );
+	}
+
+	// The last instruction - the longest way on
+	const struct insn *last = &insns[fn->first + b->last];
+	if ( last->kind == AVR_CALL ) b->exit = last->cycles + callee_cycles( last );
+	else if ( last->kind == AVR_RETURN ) b->exit = last->cycles;
+	else if ( last->kind == AVR_JUMP && !b->succ_count ) b->exit = last->cycles + callee_cycles( last ); // Tail call
+	else if ( !b->succ_count ) fail( last, "falls through the end of the function" );
+
+	// A call followed by more code continues to the next block
+	unsigned long worst = 0;
+	if ( last->kind == AVR_CALL && b->succ_count ) b->edge[0] = b->exit;
+
+	if ( !b->succ_count )
+		worst = b->exit;
+	for ( uint8_t k = 0; k < b->succ_count; k++ )
+	{
+		unsigned long w = b->edge[k] + analyze_block( fn, b->succ[k] );
+		if ( w > worst || b->next < 0 )
+		{
+			worst = w;
+			b->next = b->succ[k];
+		}
+	}
+
+	b->worst = b->cycles + worst;
+	b->state = 2;
+	return b->worst;
+}
+
+//! Worst case of a function from the first instruction to the return
+static unsigned long analyze_function( struct function *fn )
+{
+	if ( fn->state == 2 ) return fn->worst;
+	fn->state = 1;
+	split_blocks( fn );
+	fn->worst = analyze_block( fn, 0 );
+	fn->state = 2;
+	return fn->worst;
+}
+
+//! Prints the blocks of a function
+static void print_function( const struct function *fn )
+{
+	printf( "%s: %lu cycles\n", fn->name, fn->worst );
+	printf( "    block            insns  cycles  worst from here\n" );
+
+	// Blocks on the worst path
+	uint8_t *on_path = calloc( fn->block_count, 1 );
+	if ( on_path == NULL ) fail( NULL, "out of memory" );
+	for ( int j = 0; j >= 0; j = fn->blocks[j].next )
+		on_path[j] = 1;
+
+	for ( size_t j = 0; j < fn->block_count; j++ )
+	{
+		const struct block *b = &fn->blocks[j];
+		if ( b->state != 2 ) continue;
+
+		// Block cycles including the last instruction on the worst way on
+		unsigned int cycles = b->cycles + b->exit;
+		for ( uint8_t k = 0; k < b->succ_count; k++ )
+			if ( (int) b->succ[k] == b->next )
+				cycles = b->cycles + b->edge[k];
+
+		printf( "  %c 0x%04" PRIx32 "-0x%04" PRIx32 "  %5zu  %6u  %15lu\n", on_path[j] ? '*' : ' ',
+			insns[fn->first + b->first].addr, insns[fn->first + b->last].addr,
+			b->last - b->first + 1, cycles, b->worst );
+	}
+
+	free( on_path );
+}
+
+// ---------------------------------------------
+
+int main( int argc, char **argv )
+{
+	const char *symbol = NULL;
+	long budget = -1;
+	unsigned int entry = 7;
+	int opt;
+
+	while ( ( opt = getopt( argc, argv, "f:b:e:" ) ) != -1 )
+	{
+		switch ( opt )
+		{
+			case 'f': symbol = optarg; break;
+			case 'b': budget = strtol( optarg, NULL, 0 ); break;
+			case 'e': entry = strtoul( optarg, NULL, 0 ); break;
+
+			default:
+				symbol = NULL;
+				optind = argc;
+				break;
+		}
+	}
+
+	if ( symbol == NULL || optind < argc - 1 )
+	{
+		fprintf( stderr, "usage: %s -f symbol [-b budget] [-e entry cycles] [objdump -d output]\n", argv[0] );
+		return 1;
+	}
+
+	FILE *f = stdin;
+	if ( optind < argc && ( f = fopen( argv[optind], "r" ) ) == NULL )
+	{
+		perror( argv[optind] );
+		return 1;
+	}
+
+	read_disassembly( f );
+	if ( f != stdin ) fclose( f );
+
+	struct function *fn = find_function( symbol );
+	if ( fn == NULL )
+	{
+		fprintf( stderr, "isrcycles: %s not found in the disassembly\n", symbol );
+		return 1;
+	}
+
+	unsigned long total = entry + analyze_function( fn );
+
+	// The handler first, then the functions it calls
+	print_function( fn );
+	for ( size_t i = 0; i < function_count; i++ )
+		if ( &functions[i] != fn && functions[i].state == 2 )
+			print_function( &functions[i] );
+
+	printf( "%s: worst case %lu cycles (%u entry + %lu)", symbol, total, entry, fn->worst );
+	if ( budget >= 0 )
+		printf( ", budget %ld cycles", budget );
+	printf( "\n" );
+
+	if ( budget >= 0 && total > (unsigned long) budget )
+	{
+		fprintf( stderr, "isrcycles: %s exceeds the budget by %lu cycles\n", symbol, total - budget );
+		return 1;
+	}
+
+	return 0;
+}
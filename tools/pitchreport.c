@@ -0,0 +1,74 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "../src/pitch.h"
+
+/**
+	\file pitchreport.c
+	\brief Pitch table accuracy report
+
+	Checks that every pitch_lut entry is the correctly rounded 32768 * 2^(i/192), then compares
+	pitch_step() and pitch_step24() with exact phase steps for every pitch (1/256 semitone apart)
+	and prints the worst error in cents for each octave. The table is made of integer literals,
+	so it's the same one the firmware contains.
+
+	Usage: pitchreport [sample rate]
+*/
+
+//! Error of a phase step in cents
+static double step_error( double step, double exact )
+{
+	return fabs( 1200 * log2( step / exact ) );
+}
+
+int main( int argc, char **argv )
+{
+	unsigned long samplerate = argc > 1 ? strtoul( argv[1], NULL, 0 ) : 32000;
+	if ( samplerate == 0 )
+	{
+		fprintf( stderr, "usage: %s [sample rate]\n", argv[0] );
+		return 1;
+	}
+
+	// The table entries
+	unsigned int bad_entries = 0;
+	for ( unsigned int i = 0; i < PITCH_LUT_SIZE; i++ )
+	{
+		uint16_t exact = lrint( 32768 * exp2( (double) i / PITCH_LUT_SIZE ) );
+		uint16_t entry = rom_read_word( pitch_lut + i );
+		if ( entry != exact )
+		{
+			printf( "pitch_lut[%u] is %u, should be %u\n", i, entry, exact );
+			bad_entries++;
+		}
+	}
+	if ( bad_entries ) return 1;
+	printf( "pitch table: %u entries correctly rounded\n", PITCH_LUT_SIZE );
+
+	uint16_t base = PITCH_BASE( samplerate );
+	printf( "sample rate %lu Hz, base step %u\n", samplerate, base );
+	printf( "octave  notes    max error (16-bit step)  max error (24-bit step)\n" );
+
+	for ( unsigned int octave = 0; octave < 11; octave++ )
+	{
+		double max16 = 0, max24 = 0;
+		unsigned int first = PITCH( octave * 12 ), last = PITCH( octave * 12 + 12 ) - 1;
+		if ( last > PITCH_MAX ) last = PITCH_MAX;
+
+		for ( unsigned int pitch = first; pitch <= last; pitch++ )
+		{
+			double freq = 440 * pow( 2, ( pitch / 256.0 - 69 ) / 12 );
+			double exact = 65536 * freq / samplerate;
+			double e16 = step_error( pitch_step( pitch, base ), exact );
+			double e24 = step_error( pitch_step24( pitch, base ) / 256.0, exact );
+			if ( e16 > max16 ) max16 = e16;
+			if ( e24 > max24 ) max24 = e24;
+		}
+
+		printf( "%6u  %3u-%3u  %17.3f cents  %17.3f cents\n", octave, first >> 8, last >> 8, max16, max24 );
+	}
+
+	return 0;
+}
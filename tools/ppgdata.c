@@ -0,0 +1,653 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/synth_core.h"
+#include "../src/wavepack.h"
+#include "../aplay/ppg_bank.h"
+
+/**
+	\file ppgdata.c
+	\brief PPG data generator
+
+	Reads raw dumps of the PPG waveform EPROM (64-byte half-waves, one after another) and
+	the wavetable EPROM (the wavetable stream) and generates the data sources:
+	 - c           - src/ppg_data.c for the firmware
+	 - waveforms-h - aplay/evu10_waveforms.h
+	 - wavetable-h - aplay/evu10_wavetable.h
+	 - bank        - a bank file for aplay (see aplay/ppg_bank.h)
+
+	Options:
+	 - -p - waveforms not referenced by any valid wavetable are left out, the remaining ones
+	        are renumbered and the wavetables are rewritten to use the new numbers (data
+	        following the last valid wavetable is dropped as well). Every wavetable is then
+	        loaded from both versions and compared slot by slot.
+	 - -x - waveforms are pre-expanded into full 128-sample cycles (waveforms-h and bank only)
+	 - -z max_error - waveforms are compressed (see wavepack.h) - identical waveforms are
+	        stored once and every waveform gets the smallest encoding whose reconstruction
+	        error doesn't exceed max_error. Every record is decoded back with wavepack_expand()
+	        (the code used by the firmware) and checked. (c only)
+
+	 - -n name - name stored in the bank metadata (the wavetable dump file name by default)
+
+	Unlike the firmware, the generator is not limited to WAVETABLE_INDEX_SIZE wavetables.
+
+	Usage: ppgdata -w waveforms.bin -t wavetable.bin [-f format] [-p] [-x] [-z max_error] [-n name] > output
+
+	A report is printed on stderr.
+*/
+
+#define WAVE_SIZE 64
+#define WAVE_MAX 256
+#define WAVETABLE_MAX ( 1 << 20 )
+
+//! PPG data
+struct ppg_data
+{
+	uint8_t waveforms[WAVE_MAX * WAVE_SIZE];
+	uint16_t waveforms_size;
+	uint8_t wavetable[WAVETABLE_MAX];
+	uint32_t wavetable_size;
+
+	//! PPG number of each waveform
+	uint8_t number[WAVE_MAX];
+};
+
+//! Wavetables found in the data (a wavetable takes at least 5 bytes)
+struct ppg_wavetables
+{
+	const uint8_t *data;
+	uint32_t count;
+	uint32_t offset[WAVETABLE_MAX / 5 + 1];
+};
+
+//! Compressed waveforms
+struct ppg_packed
+{
+	uint8_t records[WAVE_MAX * ( WAVE_SIZE + 1 )];
+	uint16_t records_size;
+	uint16_t index[WAVE_MAX];
+	uint16_t count;
+};
+
+static const char *encoding_names[WAVEPACK_ENCODINGS] = {"raw", "delta4", "delta6", "quant4", "quant6"};
+
+//! Reads a whole file - returns its size or -1 on error
+static long read_file( const char *path, uint8_t *buffer, long max_size )
+{
+	FILE *f = fopen( path, "rb" );
+	if ( f == NULL ) return -1;
+
+	long size = fread( buffer, 1, max_size, f );
+	if ( fgetc( f ) != EOF ) size = -1;
+	fclose( f );
+	return size;
+}
+
+// ---------------------------------------------
+
+/**
+	Finds all valid wavetables in the data (like wavetable_index_scan(), but without the limit)
+	The offset following the last wavetable is stored as well.
+*/
+static void ppg_wavetables_scan( struct ppg_wavetables *w, const struct ppg_data *d )
+{
+	const uint8_t *ptr = d->wavetable, *end = d->wavetable + d->wavetable_size, *next;
+
+	w->data = d->wavetable;
+	w->count = 0;
+	while ( ptr < end && ( next = skip_wavetable( DEFAULT_WAVETABLE_SIZE, ptr, end ) ) != NULL )
+	{
+		w->offset[w->count++] = ptr - d->wavetable;
+		ptr = next;
+	}
+	w->offset[w->count] = ptr - d->wavetable;
+}
+
+//! Returns a pointer to the n-th wavetable
+static inline const uint8_t *ppg_wavetables_get( const struct ppg_wavetables *w, uint32_t n )
+{
+	return w->data + w->offset[n];
+}
+
+//! Marks waveforms referenced by the wavetables
+static void ppg_data_referenced( const struct ppg_wavetables *w, uint8_t *referenced )
+{
+	memset( referenced, 0, WAVE_MAX );
+	for ( uint32_t n = 0; n < w->count; n++ )
+	{
+		const uint8_t *ptr = ppg_wavetables_get( w, n ) + 1;
+		uint8_t pos;
+		do
+		{
+			referenced[ptr[0]] = 1;
+			pos = ptr[1];
+			ptr += 2;
+		}
+		while ( pos < DEFAULT_WAVETABLE_SIZE - 1 );
+	}
+}
+
+//! Removes unreferenced waveforms and data following the last valid wavetable
+static void ppg_data_prune( struct ppg_data *d, const struct ppg_data *src, const struct ppg_wavetables *w )
+{
+	uint8_t referenced[WAVE_MAX], remap[WAVE_MAX];
+
+	ppg_data_referenced( w, referenced );
+	memset( d, 0, sizeof( *d ) );
+
+	// Referenced waveforms keep their order
+	for ( unsigned int n = 0; n < src->waveforms_size / WAVE_SIZE; n++ )
+	{
+		if ( !referenced[n] ) continue;
+		uint8_t m = d->waveforms_size / WAVE_SIZE;
+		memcpy( d->waveforms + d->waveforms_size, src->waveforms + n * WAVE_SIZE, WAVE_SIZE );
+		d->waveforms_size += WAVE_SIZE;
+		d->number[m] = src->number[n];
+		remap[n] = m;
+	}
+
+	// Wavetables with new waveform numbers
+	for ( uint32_t n = 0; n < w->count; n++ )
+	{
+		const uint8_t *ptr = ppg_wavetables_get( w, n );
+		uint8_t *dest = d->wavetable + d->wavetable_size;
+		uint8_t pos;
+
+		*dest++ = *ptr++;
+		do
+		{
+			*dest++ = remap[ptr[0]];
+			*dest++ = pos = ptr[1];
+			ptr += 2;
+		}
+		while ( pos < DEFAULT_WAVETABLE_SIZE - 1 );
+
+		d->wavetable_size = dest - d->wavetable;
+	}
+}
+
+//! Checks if all wavetables sound the same in both versions of the data
+static int ppg_data_compare( const struct ppg_data *a, const struct ppg_data *b )
+{
+	static struct ppg_wavetables wa, wb;
+	struct wavetable_entry ea[DEFAULT_WAVETABLE_SIZE], eb[DEFAULT_WAVETABLE_SIZE];
+
+	ppg_wavetables_scan( &wa, a );
+	ppg_wavetables_scan( &wb, b );
+	if ( wa.count != wb.count ) return 0;
+
+	for ( uint32_t n = 0; n < wa.count; n++ )
+	{
+		load_wavetable( ea, DEFAULT_WAVETABLE_SIZE, ppg_wavetables_get( &wa, n ) );
+		load_wavetable( eb, DEFAULT_WAVETABLE_SIZE, ppg_wavetables_get( &wb, n ) );
+		for ( int i = 0; i < DEFAULT_WAVETABLE_SIZE; i++ )
+		{
+			if ( ea[i].factor != eb[i].factor
+				|| memcmp( get_waveform_pointer( a->waveforms, ea[i].wave_l ), get_waveform_pointer( b->waveforms, eb[i].wave_l ), WAVE_SIZE )
+				|| memcmp( get_waveform_pointer( a->waveforms, ea[i].wave_r ), get_waveform_pointer( b->waveforms, eb[i].wave_r ), WAVE_SIZE ) )
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+// ---------------------------------------------
+
+//! Bit stream writer (LSB first) - counterpart of the reader in wavepack.c
+struct bit_writer
+{
+	uint8_t *ptr;
+	uint16_t acc;
+	uint8_t bits;
+};
+
+static void bit_write( struct bit_writer *w, uint8_t value, uint8_t width )
+{
+	w->acc |= (uint16_t)( value & ( ( 1u << width ) - 1 ) ) << w->bits;
+	w->bits += width;
+	while ( w->bits >= 8 )
+	{
+		*w->ptr++ = w->acc;
+		w->acc >>= 8;
+		w->bits -= 8;
+	}
+}
+
+static uint8_t *bit_flush( struct bit_writer *w )
+{
+	if ( w->bits ) *w->ptr++ = w->acc;
+	return w->ptr;
+}
+
+//! Encodes a wave - returns the record size
+static int encode_wave( uint8_t *record, const uint8_t *wave, int encoding )
+{
+	struct bit_writer w = {.ptr = record + 1};
+	uint8_t width = ( encoding == WAVEPACK_DELTA4 || encoding == WAVEPACK_QUANT4 ) ? 4 : 6;
+	int min = -( 1 << ( width - 1 ) ), max = ( 1 << ( width - 1 ) ) - 1;
+	int r = wave[0];
+
+	record[0] = encoding;
+	for ( int i = 0; i < WAVE_SIZE; i++ )
+	{
+		switch ( encoding )
+		{
+			case WAVEPACK_RAW:
+				bit_write( &w, wave[i], 8 );
+				break;
+
+			// Differences from the reconstructed signal, so errors don't accumulate
+			case WAVEPACK_DELTA4:
+			case WAVEPACK_DELTA6:
+				if ( i == 0 )
+					bit_write( &w, wave[0], 8 );
+				else
+				{
+					int d = wave[i] - r;
+					if ( d < min ) d = min;
+					if ( d > max ) d = max;
+					bit_write( &w, d, width );
+					r += d;
+				}
+				break;
+
+			case WAVEPACK_QUANT4:
+			case WAVEPACK_QUANT6:
+				bit_write( &w, wave[i] >> ( 8 - width ), width );
+				break;
+		}
+	}
+
+	return bit_flush( &w ) - record;
+}
+
+//! Returns maximum absolute reconstruction error of a record
+static int record_error( const uint8_t *record, const uint8_t *wave )
+{
+	uint8_t cycle[WAVEFORM_CYCLE_SIZE], expected[WAVEFORM_CYCLE_SIZE];
+	int error = 0;
+
+	wavepack_expand( cycle, record );
+	expand_waveform( expected, wave );
+	for ( int i = 0; i < WAVEFORM_CYCLE_SIZE; i++ )
+	{
+		int e = abs( cycle[i] - expected[i] );
+		if ( e > error ) error = e;
+	}
+
+	return error;
+}
+
+//! Returns current time in nanoseconds
+static double now_ns( )
+{
+	struct timespec t;
+	clock_gettime( CLOCK_MONOTONIC, &t );
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+//! Measures average time of decoding all key waves of a wavetable
+static double wavetable_decode_time( const struct ppg_packed *p, const uint8_t *data, int *keys )
+{
+	static uint8_t cycle[WAVEFORM_CYCLE_SIZE];
+	const int repeats = 1000;
+	double t_start = now_ns( );
+
+	for ( int n = 0; n < repeats; n++ )
+	{
+		const uint8_t *ptr = data + 1;
+		uint8_t pos;
+		*keys = 0;
+		do
+		{
+			wavepack_expand( cycle, wavepack_record( p->index, p->records, ptr[0] ) );
+			pos = ptr[1];
+			ptr += 2;
+			( *keys )++;
+		}
+		while ( pos < DEFAULT_WAVETABLE_SIZE - 1 );
+	}
+
+	return ( now_ns( ) - t_start ) / repeats;
+}
+
+//! Compresses the waveforms - returns 0 on error
+static int ppg_data_pack( struct ppg_packed *p, const struct ppg_data *d, const struct ppg_wavetables *w, int max_error )
+{
+	int encoding_count[WAVEPACK_ENCODINGS] = {0}, duplicates = 0, worst_error = 0;
+
+	memset( p, 0, sizeof( *p ) );
+	p->count = d->waveforms_size / WAVE_SIZE;
+	for ( unsigned int n = 0; n < p->count; n++ )
+	{
+		const uint8_t *wave = d->waveforms + n * WAVE_SIZE;
+
+		// Identical waves share the record
+		unsigned int m;
+		for ( m = 0; m < n && memcmp( wave, d->waveforms + m * WAVE_SIZE, WAVE_SIZE ); m++ );
+		if ( m < n )
+		{
+			p->index[n] = p->index[m];
+			duplicates++;
+			continue;
+		}
+
+		// The smallest encoding within the error bound (raw is always fine)
+		uint8_t *record = p->records + p->records_size, candidate[WAVE_SIZE + 1];
+		int size = encode_wave( record, wave, WAVEPACK_RAW ), error = 0;
+		for ( int encoding = WAVEPACK_RAW + 1; encoding < WAVEPACK_ENCODINGS; encoding++ )
+		{
+			int candidate_size = encode_wave( candidate, wave, encoding );
+			int candidate_error = record_error( candidate, wave );
+			if ( candidate_error <= max_error && ( candidate_size < size || ( candidate_size == size && candidate_error < error ) ) )
+			{
+				memcpy( record, candidate, candidate_size );
+				size = candidate_size;
+				error = candidate_error;
+			}
+		}
+
+		if ( record_error( record, wave ) != error )
+		{
+			fprintf( stderr, "ppgdata: wave %u doesn't decode correctly\n", n );
+			return 0;
+		}
+
+		if ( error > worst_error ) worst_error = error;
+		encoding_count[record[0]]++;
+		p->index[n] = p->records_size;
+		p->records_size += size;
+	}
+
+	// The report
+	unsigned int packed_size = p->records_size + p->count * sizeof( uint16_t );
+	fprintf( stderr, "ppgdata: %u waves, %d duplicates, max error %d (bound %d)\n", p->count, duplicates, worst_error, max_error );
+	for ( int encoding = 0; encoding < WAVEPACK_ENCODINGS; encoding++ )
+		fprintf( stderr, "ppgdata: %8s: %d waves\n", encoding_names[encoding], encoding_count[encoding] );
+	fprintf( stderr, "ppgdata: %u bytes -> %u bytes (%u records + %u index), %u bytes of flash saved\n",
+		d->waveforms_size, packed_size, p->records_size, (unsigned int)( p->count * sizeof( uint16_t ) ), d->waveforms_size - packed_size );
+
+	// Decode time of all key waves of each wavetable
+	double t_max = 0, t_sum = 0;
+	int keys_max = 0;
+	for ( uint32_t n = 0; n < w->count; n++ )
+	{
+		int keys;
+		double t = wavetable_decode_time( p, ppg_wavetables_get( w, n ), &keys );
+		t_sum += t;
+		if ( t > t_max ) t_max = t;
+		if ( keys > keys_max ) keys_max = keys;
+	}
+	fprintf( stderr, "ppgdata: decoding all key waves of a wavetable takes %.0f ns on average, %.0f ns max (up to %d keys) on this machine\n",
+		t_sum / w->count, t_max, keys_max );
+
+	return 1;
+}
+
+// ---------------------------------------------
+
+//! Writes the wavetable stream as a C array
+static void write_wavetable_array( FILE *f, const char *declaration, const struct ppg_data *d )
+{
+	fprintf( f, "%s = {\n", declaration );
+	for ( uint32_t i = 0; i < d->wavetable_size; i++ )
+	{
+		if ( i % 16 ) fprintf( f, "\t0x%02x,\n", d->wavetable[i] );
+		else fprintf( f, "\t0x%02x, // 0x%08x\n", d->wavetable[i], i );
+	}
+	fprintf( f, "};\n" );
+}
+
+//! Writes the waveforms (optionally expanded into full cycles) as a C array
+static void write_waveform_array( FILE *f, const char *declaration, const struct ppg_data *d, int pruned, int expanded )
+{
+	unsigned int size = expanded ? WAVEFORM_CYCLE_SIZE : WAVE_SIZE;
+
+	fprintf( f, "%s = {\n", declaration );
+	for ( unsigned int n = 0; n < d->waveforms_size / WAVE_SIZE; n++ )
+	{
+		uint8_t cycle[WAVEFORM_CYCLE_SIZE];
+		const uint8_t *wave = d->waveforms + n * WAVE_SIZE;
+		if ( expanded )
+		{
+			expand_waveform( cycle, wave );
+			wave = cycle;
+		}
+
+		for ( unsigned int s = 0; s < size; s++ )
+		{
+			fprintf( f, "\t%3d,\t// ", wave[s] );
+			if ( s != 0 )
+				fprintf( f, "sample %02u\n", s );
+			else if ( pruned )
+				fprintf( f, "-------- wave %03u (%02xh) = PPG wave %03u (%02xh), sample 00\n", n, n, d->number[n], d->number[n] );
+			else
+				fprintf( f, "-------- wave %03u (%02xh), sample 00\n", n, n );
+		}
+	}
+	fprintf( f, "};\n" );
+}
+
+//! Writes src/ppg_data.c (with packed waveforms if p is not NULL)
+static void write_c( FILE *f, const struct ppg_data *d, const struct ppg_packed *p, int pruned )
+{
+	fprintf( f, "#include <inttypes.h>\n#include <avr/pgmspace.h>\n#include \"ppg_data.h\"\n\n\n" );
+	write_wavetable_array( f, "const uint8_t ppg_wavetable[] PROGMEM", d );
+	fprintf( f, "\nconst uint16_t ppg_wavetable_size = sizeof( ppg_wavetable );\n\n\n" );
+
+	if ( p == NULL )
+	{
+		write_waveform_array( f, "const uint8_t ppg_waveforms[] PROGMEM", d, pruned, 0 );
+		fprintf( f, "\n\n" );
+		return;
+	}
+
+	fprintf( f, "// Packed waveforms (see wavepack.h)\n" );
+	fprintf( f, "const uint16_t ppg_packed_index[%u] PROGMEM = {", p->count );
+	for ( unsigned int n = 0; n < p->count; n++ )
+		fprintf( f, "%s%5u,", n % 8 ? " " : "\n\t", p->index[n] );
+	fprintf( f, "\n};\n\nconst uint8_t ppg_packed_waves[%u] PROGMEM = {", p->records_size );
+	for ( unsigned int i = 0; i < p->records_size; i++ )
+		fprintf( f, "%s0x%02x,", i % 16 ? " " : "\n\t", p->records[i] );
+	fprintf( f, "\n};\n" );
+}
+
+//! Writes aplay/evu10_waveforms.h
+static void write_waveforms_h( FILE *f, const struct ppg_data *d, int pruned, int expanded )
+{
+	fprintf( f, "#ifndef EVU10_WAVEFORMS\n#define EVU10_WAVEFORMS\n\n#include <inttypes.h>\n\n" );
+	fprintf( f, "//! Size of a waveform - 64 for half-waves or 128 for pre-expanded cycles\n" );
+	fprintf( f, "#define EVU10_WAVEFORM_SIZE %d\n\n", expanded ? WAVEFORM_CYCLE_SIZE : WAVE_SIZE );
+	write_waveform_array( f, "static uint8_t evu10_waveforms[]", d, pruned, expanded );
+	fprintf( f, "\n#endif\n" );
+}
+
+//! Writes aplay/evu10_wavetable.h
+static void write_wavetable_h( FILE *f, const struct ppg_data *d )
+{
+	fprintf( f, "#ifndef EVU10_WAVETABLE\n#define EVU10_WAVETABLE\n\n#include <stdint.h>\n\n" );
+	write_wavetable_array( f, "static uint8_t evu10_wavetable[]", d );
+	fprintf( f, "\n#endif\n" );
+}
+
+//! Writes padding up to the given alignment
+static uint32_t write_padding( FILE *f, uint32_t offset, uint32_t align )
+{
+	for ( ; offset % align; offset++ )
+		fputc( 0, f );
+	return offset;
+}
+
+//! Writes a bank file (see ppg_bank.h)
+static void write_bank( FILE *f, const struct ppg_data *d, const struct ppg_wavetables *w, int expanded, const char *name )
+{
+	struct ppg_bank_header h = {.magic = PPG_BANK_MAGIC, .version = PPG_BANK_VERSION, .header_size = sizeof( h )};
+	char metadata[1024];
+
+	int metadata_size = snprintf( metadata, sizeof( metadata ), "name=%s\nwaveforms=%s\n", name, expanded ? "expanded" : "half" );
+	h.metadata_size = metadata_size < (int) sizeof( metadata ) ? metadata_size : (int) sizeof( metadata ) - 1;
+	h.metadata_offset = sizeof( h );
+	h.wavetable_index_offset = ( h.metadata_offset + h.metadata_size + 3 ) & ~3u;
+	h.wavetable_size = DEFAULT_WAVETABLE_SIZE;
+	h.wavetable_count = w->count;
+	h.wavetable_data_offset = h.wavetable_index_offset + ( w->count + 1 ) * sizeof( uint32_t );
+	h.waveform_size = expanded ? WAVEFORM_CYCLE_SIZE : WAVE_SIZE;
+	h.waveform_count = d->waveforms_size / WAVE_SIZE;
+	h.waveforms_offset = h.wavetable_data_offset + w->offset[w->count];
+	h.waveforms_offset = ( h.waveforms_offset + PPG_BANK_WAVEFORM_ALIGN - 1 ) & ~( PPG_BANK_WAVEFORM_ALIGN - 1u );
+
+	// Header and metadata
+	fwrite( &h, sizeof( h ), 1, f );
+	fwrite( metadata, 1, h.metadata_size, f );
+	write_padding( f, h.metadata_offset + h.metadata_size, sizeof( uint32_t ) );
+
+	// Index and the wavetables (only the valid ones)
+	fwrite( w->offset, sizeof( uint32_t ), w->count + 1, f );
+	fwrite( d->wavetable, 1, w->offset[w->count], f );
+	write_padding( f, h.wavetable_data_offset + w->offset[w->count], PPG_BANK_WAVEFORM_ALIGN );
+
+	// Waveforms
+	for ( unsigned int n = 0; n < h.waveform_count; n++ )
+	{
+		uint8_t cycle[WAVEFORM_CYCLE_SIZE];
+		const uint8_t *wave = d->waveforms + n * WAVE_SIZE;
+		if ( expanded )
+		{
+			expand_waveform( cycle, wave );
+			wave = cycle;
+		}
+		fwrite( wave, 1, h.waveform_size, f );
+	}
+
+	fprintf( stderr, "ppgdata: bank with %u wavetables and %u waveforms, %u bytes\n",
+		h.wavetable_count, h.waveform_count, h.waveforms_offset + h.waveform_count * h.waveform_size );
+}
+
+// ---------------------------------------------
+
+int main( int argc, char **argv )
+{
+	static struct ppg_data ppg, pruned;
+	static struct ppg_packed packed;
+	static struct ppg_wavetables wavetables;
+	const char *waveforms_path = NULL, *wavetable_path = NULL, *format = "c", *name = NULL;
+	int prune = 0, expand = 0, pack = 0, max_error = 0, opt;
+
+	while ( ( opt = getopt( argc, argv, "w:t:f:pxz:n:" ) ) != -1 )
+	{
+		switch ( opt )
+		{
+			case 'w': waveforms_path = optarg; break;
+			case 't': wavetable_path = optarg; break;
+			case 'f': format = optarg; break;
+			case 'p': prune = 1; break;
+			case 'x': expand = 1; break;
+			case 'n': name = optarg; break;
+
+			case 'z':
+				pack = 1;
+				max_error = atoi( optarg );
+				break;
+
+			default:
+				waveforms_path = NULL;
+				break;
+		}
+	}
+
+	if ( waveforms_path == NULL || wavetable_path == NULL )
+	{
+		fprintf( stderr, "usage: %s -w waveforms.bin -t wavetable.bin [-f c|waveforms-h|wavetable-h|bank] [-p] [-x] [-z max_error] [-n name] > output\n", argv[0] );
+		return 1;
+	}
+
+	// The dumps
+	long waveforms_size = read_file( waveforms_path, ppg.waveforms, sizeof( ppg.waveforms ) );
+	if ( waveforms_size <= 0 || waveforms_size % WAVE_SIZE )
+	{
+		fprintf( stderr, "ppgdata: %s is not a waveform dump (up to %d waves of %d bytes)\n", waveforms_path, WAVE_MAX, WAVE_SIZE );
+		return 1;
+	}
+
+	long wavetable_size = read_file( wavetable_path, ppg.wavetable, sizeof( ppg.wavetable ) );
+	if ( wavetable_size <= 0 )
+	{
+		fprintf( stderr, "ppgdata: %s is not a wavetable dump (up to %d bytes)\n", wavetable_path, WAVETABLE_MAX );
+		return 1;
+	}
+
+	if ( name == NULL ) name = wavetable_path;
+	ppg.waveforms_size = waveforms_size;
+	ppg.wavetable_size = wavetable_size;
+	for ( unsigned int n = 0; n < WAVE_MAX; n++ )
+		ppg.number[n] = n;
+
+	// All waveforms used by the wavetables have to be there
+	uint8_t referenced[WAVE_MAX];
+	ppg_wavetables_scan( &wavetables, &ppg );
+	ppg_data_referenced( &wavetables, referenced );
+	for ( unsigned int n = ppg.waveforms_size / WAVE_SIZE; n < WAVE_MAX; n++ )
+	{
+		if ( referenced[n] )
+		{
+			fprintf( stderr, "ppgdata: wavetables reference wave %u, which is not in %s\n", n, waveforms_path );
+			return 1;
+		}
+	}
+
+	const struct ppg_data *out = &ppg;
+	if ( prune )
+	{
+		ppg_data_prune( &pruned, &ppg, &wavetables );
+		if ( !ppg_data_compare( &ppg, &pruned ) )
+		{
+			fprintf( stderr, "ppgdata: pruned wavetables don't match the original ones\n" );
+			return 1;
+		}
+
+		unsigned int freed = ppg.waveforms_size + ppg.wavetable_size - pruned.waveforms_size - pruned.wavetable_size;
+		fprintf( stderr, "ppgdata: %u wavetables reference %u of %u waveforms\n", wavetables.count, pruned.waveforms_size / WAVE_SIZE, ppg.waveforms_size / WAVE_SIZE );
+		fprintf( stderr, "ppgdata: waveforms %u -> %u bytes, wavetables %u -> %u bytes, %u bytes of flash freed\n",
+			ppg.waveforms_size, pruned.waveforms_size, ppg.wavetable_size, pruned.wavetable_size, freed );
+
+		out = &pruned;
+		ppg_wavetables_scan( &wavetables, &pruned );
+	}
+
+	if ( !strcmp( format, "c" ) )
+	{
+		if ( expand )
+		{
+			fprintf( stderr, "ppgdata: the firmware can't use pre-expanded waveforms\n" );
+			return 1;
+		}
+
+		if ( pack && !ppg_data_pack( &packed, out, &wavetables, max_error ) )
+			return 1;
+
+		write_c( stdout, out, pack ? &packed : NULL, prune );
+	}
+	else if ( !strcmp( format, "waveforms-h" ) && !pack )
+		write_waveforms_h( stdout, out, prune, expand );
+	else if ( !strcmp( format, "wavetable-h" ) && !pack )
+		write_wavetable_h( stdout, out );
+	else if ( !strcmp( format, "bank" ) && !pack )
+		write_bank( stdout, out, &wavetables, expand, name );
+	else if ( pack )
+	{
+		fprintf( stderr, "ppgdata: aplay can't use packed waveforms\n" );
+		return 1;
+	}
+	else
+	{
+		fprintf( stderr, "ppgdata: unknown format '%s'\n", format );
+		return 1;
+	}
+
+	return 0;
+}